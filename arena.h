@@ -0,0 +1,171 @@
+/* File:     arena.h
+ *
+ * Purpose:  One region of memory for all of a process' vectors:
+ *           64-byte aligned pieces carved out of a single mapping
+ *           backed by huge pages when the system has them, and freed
+ *           with one call.
+ *
+ * Usage:    #include "arena.h", then
+ *              Arena_init(&arena, total_bytes);
+ *              a = Arena_alloc(&arena, bytes);  ...
+ *              Arena_free(&arena);
+ *           total_bytes should allow ARENA_ALIGN - 1 bytes of padding
+ *           per piece (see Arena_size).
+ *
+ * Notes:
+ * 1.  Arena_init tries, in order:  explicit huge pages (MAP_HUGETLB,
+ *     needs a hugetlbfs pool, see /proc/sys/vm/nr_hugepages);
+ *     transparent huge pages (a mapping aligned to ARENA_HUGE_PAGE
+ *     with madvise(MADV_HUGEPAGE)); plain mmap; posix_memalign.  The
+ *     environment variable VECTOR_PAGES=huge, thp or small starts the
+ *     list further down (default huge).
+ * 2.  Pieces start on ARENA_ALIGN boundaries, so the SIMD kernels
+ *     don't need to peel any elements at the start of a vector.
+ * 3.  Pages are not touched here, so the first-touch NUMA placement
+ *     of the caller still decides where they go.
+ */
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __linux__
+#include <sys/mman.h>
+#define AR_MMAP 1
+#endif
+
+#define ARENA_ALIGN 64
+#define ARENA_HUGE_PAGE (2UL << 20)
+
+enum {ARENA_HUGETLB, ARENA_THP, ARENA_SMALL, ARENA_MALLOC};
+
+typedef struct {
+   char*   base;     /* first byte handed out           */
+   size_t  size;     /* bytes available from base       */
+   size_t  used;     /* bytes handed out so far         */
+   void*   map;      /* what to munmap or free          */
+   size_t  map_len;  /* length of the mapping           */
+   int     kind;     /* ARENA_HUGETLB, ..., ARENA_MALLOC */
+} Arena;
+
+/*---------------------------------------------------------------------
+ * Function:  Arena_size
+ * Purpose:   Bytes an arena needs for count pieces of bytes each
+ */
+static size_t Arena_size(size_t bytes /* in */, int count /* in */) {
+   return count*((bytes + ARENA_ALIGN - 1)/ARENA_ALIGN*ARENA_ALIGN);
+}  /* Arena_size */
+
+/*---------------------------------------------------------------------
+ * Function:  Arena_kind_name
+ * Purpose:   Name of the kind of memory behind an arena
+ */
+static const char* Arena_kind_name(const Arena* arena /* in */) {
+   static const char* names[] = {"explicit huge page",
+      "transparent huge page", "small page", "malloc"};
+
+   return names[arena->kind];
+}  /* Arena_kind_name */
+
+/*---------------------------------------------------------------------
+ * Function:  Arena_init
+ * Purpose:   Reserve an arena of at least bytes bytes
+ * In arg:    bytes:  size of the arena
+ * Out arg:   arena:  the arena
+ * Ret val:   0 on success, -1 if no memory could be reserved
+ */
+static int Arena_init(
+      Arena*  arena  /* out */,
+      size_t  bytes  /* in  */) {
+   const char* pages = getenv("VECTOR_PAGES");
+   int first = ARENA_HUGETLB;
+#  ifdef AR_MMAP
+   size_t len;
+   char* p;
+#  endif
+
+   memset(arena, 0, sizeof(Arena));
+   if (bytes == 0) bytes = ARENA_ALIGN;
+   if (pages != NULL && strcmp(pages, "thp") == 0) first = ARENA_THP;
+   else if (pages != NULL && strcmp(pages, "small") == 0)
+      first = ARENA_SMALL;
+   else if (pages != NULL && *pages != '\0' && strcmp(pages, "huge") != 0)
+      fprintf(stderr, "VECTOR_PAGES=%s unknown, using huge\n", pages);
+
+#  ifdef AR_MMAP
+   len = (bytes + ARENA_HUGE_PAGE - 1)/ARENA_HUGE_PAGE*ARENA_HUGE_PAGE;
+#  ifdef MAP_HUGETLB
+   if (first <= ARENA_HUGETLB) {
+      p = mmap(NULL, len, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+      if (p != MAP_FAILED) {
+         arena->map = arena->base = p;
+         arena->map_len = arena->size = len;
+         arena->kind = ARENA_HUGETLB;
+         return 0;
+      }
+   }
+#  endif
+   /* Over-map by a huge page so the base can be aligned to one;
+    * THP only backs aligned 2 MiB ranges */
+   p = mmap(NULL, len + ARENA_HUGE_PAGE, PROT_READ | PROT_WRITE,
+         MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+   if (p != MAP_FAILED) {
+      arena->map = p;
+      arena->map_len = len + ARENA_HUGE_PAGE;
+      arena->base = (char*) (((size_t) p + ARENA_HUGE_PAGE - 1)
+            & ~(ARENA_HUGE_PAGE - 1));
+      arena->size = len;
+      arena->kind = ARENA_SMALL;
+#     ifdef MADV_HUGEPAGE
+      if (first <= ARENA_THP
+            && madvise(arena->base, len, MADV_HUGEPAGE) == 0)
+         arena->kind = ARENA_THP;
+#     endif
+      return 0;
+   }
+#  endif
+   if (posix_memalign(&arena->map, ARENA_ALIGN, bytes) != 0) return -1;
+   arena->base = arena->map;
+   arena->size = bytes;
+   arena->kind = ARENA_MALLOC;
+   return 0;
+}  /* Arena_init */
+
+/*---------------------------------------------------------------------
+ * Function:  Arena_alloc
+ * Purpose:   Carve an ARENA_ALIGN aligned piece out of an arena
+ * In arg:    bytes:  size of the piece
+ * In/out arg:  arena
+ * Ret val:   the piece, NULL if the arena is full
+ */
+static void* Arena_alloc(
+      Arena*  arena  /* in/out */,
+      size_t  bytes  /* in     */) {
+   size_t padded = (bytes + ARENA_ALIGN - 1)/ARENA_ALIGN*ARENA_ALIGN;
+   char* p;
+
+   if (arena->base == NULL || padded > arena->size - arena->used)
+      return NULL;
+   p = arena->base + arena->used;
+   arena->used += padded;
+   return p;
+}  /* Arena_alloc */
+
+/*---------------------------------------------------------------------
+ * Function:  Arena_free
+ * Purpose:   Release an arena and every piece carved out of it
+ */
+static void Arena_free(Arena* arena /* in/out */) {
+#  ifdef AR_MMAP
+   if (arena->kind != ARENA_MALLOC) {
+      if (arena->map != NULL) munmap(arena->map, arena->map_len);
+   } else
+#  endif
+      free(arena->map);
+   memset(arena, 0, sizeof(Arena));
+}  /* Arena_free */
+
+#endif
@@ -0,0 +1,307 @@
+/* File:     exact_sum.h
+ *
+ * Purpose:  Exact, order independent summation of doubles, used for a
+ *           dot product that is bitwise reproducible for any number of
+ *           processes and threads.
+ *
+ * Usage:    Exact_sum acc;
+ *           Exact_sum_init(&acc);
+ *           Exact_sum_add(&acc, v);  ...  (Exact_dot for x.y)
+ *           Exact_sum_merge(&acc, &other);   (exact, any order)
+ *           result = Exact_sum_value(&acc);
+ *
+ * Notes:
+ * 1.  The sum is kept as a fixed-point integer covering every finite
+ *     double:  EXACT_DIGITS signed 64-bit "digits" of 32 bits each,
+ *     digit k holding the bits of weight 2^(32k-1075) to
+ *     2^(32k-1044).  Adding a double adds its 53-bit mantissa to the
+ *     (at most three) digits it overlaps.  Integer addition is exact
+ *     and associative, so the total doesn't depend on how the terms
+ *     are split or ordered; it is rounded to a double once, at the
+ *     end.
+ * 2.  Each addition changes a digit by less than 2^32, so a digit has
+ *     room for 2^31 of them; callers of Exact_sum_add normalize
+ *     (propagate carries) at least every EXACT_NORM_EVERY additions.
+ *     The addition has no data dependent branches, so random signs
+ *     and exponents cost no mispredictions.
+ * 3.  Exact_dot sums the products x[i]*y[i] as rounded to doubles,
+ *     exactly:  the result is within half an ulp of the sum of the
+ *     rounded products, so its error is at most about
+ *     2^-53*sum |x[i]*y[i]|, not n times that.  Depositing every
+ *     product would cost several times a plain dot product, so it
+ *     works on blocks of EXACT_BLOCK products:  each product is split
+ *     at two fixed bit positions chosen from the block's largest
+ *     product ((M + p) - M extracts the bits of p above ulp(M)), the
+ *     two upper parts are summed in doubles, which is exact, and only
+ *     those sums go into the accumulator.  Products too small for
+ *     both parts are rare and added one by one.  This costs about
+ *     twice a plain dot product on one thread, less when the plain
+ *     one is limited by memory bandwidth.  x and y are elem_t (see
+ *     vector_type.h); the product of two floats is exact in double,
+ *     so for float vectors the result is the exact dot product
+ *     rounded once.
+ * 4.  Infinities and NaNs are summed separately in "special" (that sum
+ *     is also order independent).
+ * 5.  The final rounding is to nearest even, except that a result in
+ *     the subnormal range may be rounded twice.
+ * 6.  The splitting needs double arithmetic without extra precision
+ *     (FLT_EVAL_METHOD 0, e.g. SSE2, not x87) and without
+ *     -ffast-math, which would reassociate (M + p) - M to p.
+ */
+#ifndef EXACT_SUM_H
+#define EXACT_SUM_H
+
+#include <string.h>
+#include <stdint.h>
+#include <float.h>
+#include <math.h>
+#include "vector_type.h"
+
+#if defined(FLT_EVAL_METHOD) && FLT_EVAL_METHOD != 0
+#error "exact_sum.h needs FLT_EVAL_METHOD 0 (e.g. -mfpmath=sse)"
+#endif
+
+#define EXACT_DIGITS 68
+#define EXACT_NORM_EVERY (1 << 30)
+#define EXACT_MASK 0xFFFFFFFFLL
+
+/* Products per block of Exact_dot, and log2(EXACT_BLOCK) + 1:  the
+ * bits of headroom a block sum needs */
+#define EXACT_BLOCK 1024
+#define EXACT_BLOCK_BITS 11
+
+/* Independent partial sums in Exact_block, to hide the add latency */
+#define EXACT_LANES 4
+
+typedef struct {
+   long long  digit[EXACT_DIGITS];  /* digit k:  weight 2^(32k-1075) */
+   double     special;              /* sum of the inf and nan terms  */
+} Exact_sum;
+
+static void Exact_sum_init(Exact_sum* acc /* out */) {
+   memset(acc, 0, sizeof(Exact_sum));
+}  /* Exact_sum_init */
+
+/*---------------------------------------------------------------------
+ * Function:  Exact_sum_normalize
+ * Purpose:   Propagate carries so digits 0..EXACT_DIGITS-2 are in
+ *            [0, 2^32) and the top digit carries the sign
+ */
+static void Exact_sum_normalize(Exact_sum* acc /* in/out */) {
+   long long carry;
+   int k;
+
+   for (k = 0; k < EXACT_DIGITS - 1; k++) {
+      /* floor(digit/2^32) without shifting a negative number */
+      carry = (acc->digit[k] - (acc->digit[k] & EXACT_MASK))/(EXACT_MASK + 1);
+      acc->digit[k] -= carry*(EXACT_MASK + 1);
+      acc->digit[k+1] += carry;
+   }
+}  /* Exact_sum_normalize */
+
+/*---------------------------------------------------------------------
+ * Function:  Exact_sum_add
+ * Purpose:   Add a double to the sum exactly
+ */
+static inline void Exact_sum_add(
+      Exact_sum*  acc  /* in/out */,
+      double      v    /* in     */) {
+   uint64_t bits;
+   long long m, sign, hi;
+   int e, k, s;
+
+   memcpy(&bits, &v, sizeof(bits));
+   e = (int) ((bits >> 52) & 0x7FF);
+   if (e == 0x7FF) {
+      acc->special += v;
+      return;
+   }
+   /* v = m*2^(e-1075), m signed; subnormals (and 0) have e = 0 but
+    * the weight of e = 1 and no hidden bit */
+   m = (long long) ((bits & ((1ULL << 52) - 1)) | (uint64_t) (e != 0) << 52);
+   e += e == 0;
+   sign = -(long long) (bits >> 63);
+   m = (m ^ sign) - sign;
+   k = e >> 5;
+   s = e & 31;
+   /* m*2^s = hi*2^32 + low 32 bits; >> on a negative m is floor */
+   hi = m >> (32 - s);
+   acc->digit[k] += (long long) (((uint64_t) m << s) & EXACT_MASK);
+   acc->digit[k+1] += hi & EXACT_MASK;
+   acc->digit[k+2] += hi >> 32;
+}  /* Exact_sum_add */
+
+/*---------------------------------------------------------------------
+ * Function:  Exact_sum_merge
+ * Purpose:   Add the sum in other to acc
+ */
+static void Exact_sum_merge(
+      Exact_sum*        acc    /* in/out */,
+      const Exact_sum*  other  /* in     */) {
+   Exact_sum tmp = *other;
+   int k;
+
+   Exact_sum_normalize(acc);
+   Exact_sum_normalize(&tmp);
+   for (k = 0; k < EXACT_DIGITS; k++)
+      acc->digit[k] += tmp.digit[k];
+   acc->special += tmp.special;
+   Exact_sum_normalize(acc);
+}  /* Exact_sum_merge */
+
+/* 2^e for -1022 <= e <= 1023, built from its bits */
+static double Exact_pow2(int e) {
+   uint64_t bits = (uint64_t) (e + 1023) << 52;
+   double x;
+
+   memcpy(&x, &bits, sizeof(x));
+   return x;
+}  /* Exact_pow2 */
+
+/*---------------------------------------------------------------------
+ * Function:  Exact_sum_value
+ * Purpose:   Round the sum to the nearest double
+ */
+static double Exact_sum_value(const Exact_sum* sum /* in */) {
+   Exact_sum acc = *sum;
+   uint64_t d[3], top, sticky = 0;
+   double x;
+   int k, h, lz, neg = 0, e;
+
+   if (acc.special != 0) return acc.special;
+   Exact_sum_normalize(&acc);
+   if (acc.digit[EXACT_DIGITS-1] < 0) {
+      neg = 1;
+      for (k = 0; k < EXACT_DIGITS; k++) acc.digit[k] = -acc.digit[k];
+      Exact_sum_normalize(&acc);
+   }
+   for (h = EXACT_DIGITS - 1; h >= 0 && acc.digit[h] == 0; h--);
+   if (h < 0) return 0.0;
+
+   /* The 64 bits from the leading one down, with the rest folded into
+    * a sticky bit so converting to double rounds correctly */
+   for (k = 0; k < 3; k++)
+      d[k] = h - k >= 0 ? (uint64_t) acc.digit[h-k] : 0;
+   for (lz = 0; (d[0] << lz & 0x80000000ULL) == 0; lz++);
+   top = d[0] << (32 + lz) | d[1] << lz;
+   if (lz > 0) {
+      top |= d[2] >> (32 - lz);
+      sticky = (d[2] & ((1ULL << (32 - lz)) - 1)) != 0;
+   } else {
+      sticky = d[2] != 0;
+   }
+   for (k = h - 3; k >= 0 && !sticky; k--)
+      sticky = acc.digit[k] != 0;
+   x = (double) (top | sticky);
+
+   /* x*2^e, scaled in steps that stay exact; bit 0 of top is bit
+    * 32 - lz of digit h-2 */
+   e = 32*(h - 2) + 32 - lz - 1075;
+   while (e > 1000) {
+      x *= Exact_pow2(1000);
+      e -= 1000;
+   }
+   while (e < -1000) {
+      x *= Exact_pow2(-1000);
+      e += 1000;
+   }
+   x *= Exact_pow2(e);
+   return neg ? -x : x;
+}  /* Exact_sum_value */
+
+/*---------------------------------------------------------------------
+ * Function:  Exact_block
+ * Purpose:   Add x[0]*y[0] + ... + x[n-1]*y[n-1], n <= EXACT_BLOCK, to
+ *            acc, each product rounded to a double and the sum exact
+ *
+ * Note:
+ *    With every |p[j]| < 2^E, m1 = 1.5*2^(E+B) (B = EXACT_BLOCK_BITS)
+ *    rounds p[j] to q1, a multiple of ulp(m1) = 2^(E+B-52); n such
+ *    multiples sum exactly in a double.  The rest, |p[j] - q1| <=
+ *    2^(E+B-53), is split again with m2 = 1.5*2^(E+2B-53).  Whatever
+ *    is left after that (bits below 2^(E+2B-105)) is added directly.
+ *    Blocks with an E too large or small for m1 and m2 to be normal
+ *    doubles, or with an inf or nan, are added one product at a time.
+ *    Any subset of a block sums exactly too, so the loops run
+ *    EXACT_LANES independent chains (which the compiler can put in
+ *    one SIMD register); the last block is padded with zeros.
+ */
+static void Exact_block(
+      Exact_sum*    acc  /* in/out */,
+      const elem_t  x[]  /* in     */,
+      const elem_t  y[]  /* in     */,
+      int           n    /* in     */) {
+   double p[EXACT_BLOCK];
+   double big[EXACT_LANES] = {0}, s1[EXACT_LANES] = {0},
+          s2[EXACT_LANES] = {0}, left[EXACT_LANES] = {0};
+   double m1, m2, q1, q2, r;
+   uint64_t bits;
+   int j, l, e, padded = (n + EXACT_LANES - 1)/EXACT_LANES*EXACT_LANES;
+
+   for (j = 0; j < n; j++)
+      p[j] = (double) x[j]*y[j];
+   for (; j < padded; j++)
+      p[j] = 0;
+   for (j = 0; j < padded; j += EXACT_LANES)
+      for (l = 0; l < EXACT_LANES; l++)
+         big[l] = fabs(p[j+l]) > big[l] ? fabs(p[j+l]) : big[l];
+   for (l = 1; l < EXACT_LANES; l++)
+      big[0] = big[l] > big[0] ? big[l] : big[0];
+   if (!(big[0] <= 0x1p900 && big[0] >= 0x1p-900)) {
+      /* Also zero blocks, and ones with a nan (big misses it) */
+      for (j = 0; j < n; j++) Exact_sum_add(acc, p[j]);
+      return;
+   }
+
+   memcpy(&bits, &big[0], sizeof(bits));
+   e = (int) (bits >> 52) - 1022;       /* big < 2^e */
+   m1 = 1.5*Exact_pow2(e + EXACT_BLOCK_BITS);
+   m2 = 1.5*Exact_pow2(e + 2*EXACT_BLOCK_BITS - 53);
+   for (j = 0; j < padded; j += EXACT_LANES)
+      for (l = 0; l < EXACT_LANES; l++) {
+         q1 = (m1 + p[j+l]) - m1;
+         r = p[j+l] - q1;
+         q2 = (m2 + r) - m2;
+         s1[l] += q1;
+         s2[l] += q2;
+         left[l] += fabs(r - q2);
+      }
+   for (l = 0; l < EXACT_LANES; l++) {
+      Exact_sum_add(acc, s1[l]);
+      Exact_sum_add(acc, s2[l]);
+   }
+   /* left is also nan if some p[j] was */
+   for (l = 1; l < EXACT_LANES; l++)
+      left[0] += left[l];
+   if (left[0] != 0)
+      for (j = 0; j < n; j++) {
+         r = p[j] - ((m1 + p[j]) - m1);
+         Exact_sum_add(acc, r - ((m2 + r) - m2));
+      }
+}  /* Exact_block */
+
+/*---------------------------------------------------------------------
+ * Function:  Exact_dot
+ * Purpose:   Add x[0]*y[0] + ... + x[n-1]*y[n-1] to acc, each product
+ *            rounded to a double and the sum exact
+ */
+static void Exact_dot(
+      Exact_sum*    acc  /* in/out */,
+      const elem_t  x[]  /* in     */,
+      const elem_t  y[]  /* in     */,
+      long long     n    /* in     */) {
+   long long i, blocks = 0;
+   int count;
+
+   for (i = 0; i < n; i += count) {
+      count = n - i < EXACT_BLOCK ? (int) (n - i) : EXACT_BLOCK;
+      Exact_block(acc, x + i, y + i, count);
+      /* At most EXACT_BLOCK + 2*EXACT_LANES additions per block */
+      if (++blocks == EXACT_NORM_EVERY/(EXACT_BLOCK + 2*EXACT_LANES)) {
+         Exact_sum_normalize(acc);
+         blocks = 0;
+      }
+   }
+}  /* Exact_dot */
+
+#endif
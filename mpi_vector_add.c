@@ -5,74 +5,261 @@
  *           illustrates the use of MPI_Scatter and MPI_Gather.
  *
  * Compile:  mpicc -g -Wall -o mpi_vector_add mpi_vector_add.c
- * Run:      mpiexec -n <comm_sz> ./vector_add
+ *           (-DVEC_FLOAT or -DVEC_MIXED for float vectors, see
+ *           vector_type.h)
+ * Run:      mpiexec -n <comm_sz> ./mpi_vector_add [-w] [n]
+ *           mpiexec -n <comm_sz> ./mpi_vector_add [-w] -i < input
+ *           mpiexec -n <comm_sz> ./mpi_vector_add -p <chunk> < input
+ *           mpiexec -n <comm_sz> ./mpi_vector_add -f <x> <y> <z>
+ *           mpiexec -n <comm_sz> ./mpi_vector_add -s <tile> <x> <y> <z>
  *
- * Input:    The order of the vectors, n, and the vectors x and y
- * Output:   The sum vector z = x+y
+ * Input:    By default each process generates its own block of
+ *           x = y = (0, 1, ..., n-1) (n defaults to 10000000), with no
+ *           communication.  With -i, process 0 reads the order of the
+ *           vectors, n, and the vectors x and y from stdin and
+ *           scatters them.  -p <chunk> reads the same input, but
+ *           pipelined:  see Pipeline_vector_sum.  With -f, x and y
+ *           are binary vector files
+ *           (see vector_file.h) and each process reads its own block
+ *           with collective MPI-IO.  -s streams the files instead:
+ *           x and y are read, added and written in tiles of <tile>
+ *           elements, so vectors larger than memory can be added.
+ * Output:   The time taken.  With -i or -p, also the sum vector
+ *           z = x+y;
+ *           with -f or -s, z is written to the binary vector file <z>,
+ *           each process writing its own block.
+ *
+ *           -w keeps the vectors of the processes on a node in
+ *           MPI-3 shared memory windows (see Allocate_shared_vector).
+ *           Only one leader process per node takes part in the
+ *           scatter and gather; it reads and writes the whole node's
+ *           part of the vector in place.
  *
  * Notes:
- * 1.  The order of the vectors, n, should be evenly divisible
- *     by comm_sz
+ * 1.  The order of the vectors, n, need not be divisible by comm_sz:
+ *     the first n % comm_sz processes get one extra element, and
+ *     MPI_Scatterv/MPI_Gatherv move the uneven blocks
  * 2.  DEBUG compile flag.
  * 3.  This program does fairly extensive error checking.  When
  *     an error is detected, a message is printed and the processes
  *     quit.  Errors detected are incorrect values of the vector
- *     order (negative or not evenly divisible by comm_sz), and
- *     malloc failures.
+ *     order (not positive), malloc failures, and vector files that
+ *     can't be opened, are malformed or have different orders.
  *
  * IPP:  Section 3.4.6 (pp. 109 and ff.)
  */
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <limits.h>
 #include <mpi.h>
+#include "vector_file.h"
+#include "vector_type.h"
+
+/* Largest number of elements moved by one point-to-point message or
+ * MPI-IO call */
+#define MAX_MSG_COUNT (1 << 30)
+
+/* Where x and y come from, and the longest vector file name */
+enum {GENERATE, READ_STDIN, PIPE_STDIN, READ_FILES, STREAM_FILES};
+#define MAX_NAME 1024
+
+/* Chunks of x or y process 0 can have in flight with -p, and the
+ * tags of the pipeline's messages */
+#define PIPE_DEPTH 4
+enum {X_TAG = 1, Y_TAG, Z_TAG};
+
+/* Phases timed on every process and summarized by Report_phases */
+#define PROGRAM "mpi_vector_add"
+enum {ALLOC, INIT, SCATTER, READ, COMPUTE, WRITE, PHASE_COUNT};
+char* phase_names[PHASE_COUNT] = {"alloc", "init", "scatter", "read",
+   "compute", "write"};
 
 void Check_for_error(int local_ok, char fname[], char message[],
       MPI_Comm comm);
-void Read_n(int* n_p, int* local_n_p, int my_rank, int comm_sz,
-      MPI_Comm comm);
-void Allocate_vectors(double** local_x_pp, double** local_y_pp,
-      double** local_z_pp, int local_n, MPI_Comm comm);
-void Read_vector(double local_a[], int local_n, int n, char vec_name[],
+void Get_args(int argc, char* argv[], long long* n_p, int* input_p,
+      int* shared_p, long long* tile_p, char files[][MAX_NAME],
+      int my_rank, MPI_Comm comm);
+void Read_n(long long* n_p, long long* local_n_p, int my_rank,
+      int comm_sz, MPI_Comm comm);
+void Allocate_vectors(elem_t** local_x_pp, elem_t** local_y_pp,
+      elem_t** local_z_pp, long long local_n, MPI_Comm comm);
+void Read_vector(elem_t local_a[], long long local_n, long long n,
+      char vec_name[], int my_rank, MPI_Comm comm);
+void Generate_vector(elem_t local_a[], long long local_first,
+      long long local_n);
+void Print_vector(elem_t local_b[], long long local_n, long long n,
+      char title[], int my_rank, MPI_Comm comm);
+void Print_values(elem_t b[], long long n, char title[]);
+void Open_vector_file(char file[], MPI_File* fh_p, long long* n_p,
+      int my_rank, MPI_Comm comm);
+void Read_vector_file(MPI_File* fh_p, elem_t local_a[], long long local_n,
+      long long n, int my_rank, MPI_Comm comm);
+void Write_vector_file(char file[], elem_t local_b[], long long local_n,
+      long long n, int my_rank, MPI_Comm comm);
+void Create_vector_file(char file[], MPI_File* fh_p, long long n,
       int my_rank, MPI_Comm comm);
-void Print_vector(double local_b[], int local_n, int n, char title[],
+void Stream_vector_sum(MPI_File* x_fh_p, MPI_File* y_fh_p, char z_file[],
+      long long n, long long tile, double phase_ms[], int my_rank,
+      MPI_Comm comm);
+void Pipeline_vector_sum(elem_t local_x[], elem_t local_y[],
+      elem_t local_z[], elem_t z[], long long local_n, long long n,
+      long long chunk, double phase_ms[], int my_rank, MPI_Comm comm);
+long long Piece_count(long long first, long long count, long long chunk);
+void Piece(long long first, long long count, long long chunk,
+      long long i, long long* piece_first_p, long long* piece_n_p);
+void Parallel_vector_sum(elem_t local_x[], elem_t local_y[],
+      elem_t local_z[], long long local_n);
+void Split_nodes(long long n, MPI_Comm comm, MPI_Comm* node_comm_p,
+      MPI_Comm* leader_comm_p, long long* node_n_p, long long* local_first_p,
+      long long* local_n_p);
+void Allocate_shared_vector(elem_t** local_a_pp, elem_t** node_a_pp,
+      MPI_Win* win_p, long long local_n, MPI_Comm node_comm);
+void Node_sync(MPI_Win win, MPI_Comm node_comm);
+long long Block_first(long long n, int comm_sz, int q);
+long long Block_size(long long n, int comm_sz, int q);
+void Build_counts(long long n, int comm_sz, int counts[], int displs[]);
+void Scatter_blocks(elem_t a[], elem_t local_a[], long long local_n,
+      long long n, int my_rank, MPI_Comm comm);
+void Gather_blocks(elem_t local_b[], elem_t b[], long long local_n,
+      long long n, int my_rank, MPI_Comm comm);
+void Send_large(elem_t buf[], long long count, int dest, MPI_Comm comm);
+void Recv_large(elem_t buf[], long long count, int source, MPI_Comm comm);
+double Lap_ms(double* start_p);
+void Report_phases(double phase_ms[], long long n, int threads,
       int my_rank, MPI_Comm comm);
-void Parallel_vector_sum(double local_x[], double local_y[],
-      double local_z[], int local_n);
 
 
 /*-------------------------------------------------------------------*/
-int main(void) {
-   int n, local_n;
-   int comm_sz, my_rank;
-   double *local_x, *local_y, *local_z;
-   MPI_Comm comm;
-   double tstart, tend;
-
-   MPI_Init(NULL, NULL);
+int main(int argc, char* argv[]) {
+   long long n, local_n, local_first, y_n, tile, node_n;
+   int comm_sz, my_rank, input, shared, leader_rank;
+   char files[3][MAX_NAME];
+   elem_t *local_x, *local_y, *local_z;
+   elem_t *node_x, *node_y, *node_z;
+   elem_t* z = NULL;
+   MPI_Comm comm, node_comm, leader_comm;
+   MPI_File x_fh, y_fh;
+   MPI_Win x_win, y_win, z_win;
+   double tstart, tend, lap;
+   double phase_ms[PHASE_COUNT] = {0};
+
+   MPI_Init(&argc, &argv);
    comm = MPI_COMM_WORLD;
    MPI_Comm_size(comm, &comm_sz);
    MPI_Comm_rank(comm, &my_rank);
 
-   //Read_n(&n, &local_n, my_rank, comm_sz, comm);
-   n = 10000000;
-   tstart = MPI_Wtime();
-   Allocate_vectors(&local_x, &local_y, &local_z, local_n, comm);
+   Get_args(argc, argv, &n, &input, &shared, &tile, files, my_rank, comm);
+   if (input == READ_STDIN || input == PIPE_STDIN) {
+      Read_n(&n, &local_n, my_rank, comm_sz, comm);
+   } else if (input == READ_FILES || input == STREAM_FILES) {
+      Open_vector_file(files[0], &x_fh, &n, my_rank, comm);
+      Open_vector_file(files[1], &y_fh, &y_n, my_rank, comm);
+      Check_for_error(y_n == n, "main", "x and y have different orders",
+            comm);
+      local_n = Block_size(n, comm_sz, my_rank);
+   } else {
+      local_n = Block_size(n, comm_sz, my_rank);
+   }
+   local_first = Block_first(n, comm_sz, my_rank);
+   if (shared) {
+      Split_nodes(n, comm, &node_comm, &leader_comm, &node_n, &local_first,
+            &local_n);
+      if (leader_comm != MPI_COMM_NULL)
+         MPI_Comm_rank(leader_comm, &leader_rank);
+   }
+   tstart = lap = MPI_Wtime();
+   if (input == STREAM_FILES) {
+      local_x = local_y = local_z = NULL;
+      Stream_vector_sum(&x_fh, &y_fh, files[2], n, tile, phase_ms, my_rank,
+            comm);
+   } else {
+      if (shared) {
+         Allocate_shared_vector(&local_x, &node_x, &x_win, local_n,
+               node_comm);
+         Allocate_shared_vector(&local_y, &node_y, &y_win, local_n,
+               node_comm);
+         Allocate_shared_vector(&local_z, &node_z, &z_win, local_n,
+               node_comm);
+      } else {
+         Allocate_vectors(&local_x, &local_y, &local_z, local_n, comm);
+      }
+      if (input == PIPE_STDIN && my_rank == 0) {
+         z = malloc((size_t) n*sizeof(elem_t));
+         Check_for_error(z != NULL, "main", "Can't allocate z", comm);
+      } else if (input == PIPE_STDIN) {
+         Check_for_error(1, "main", "Can't allocate z", comm);
+      }
+      phase_ms[ALLOC] = Lap_ms(&lap);
 
-   Read_vector(local_x, local_n, n, "x", my_rank, comm);
-   //Print_vector(local_x, local_n, n, "x is", my_rank, comm);
-   Read_vector(local_y, local_n, n, "y", my_rank, comm);
-   //Print_vector(local_y, local_n, n, "y is", my_rank, comm);
+      if (input == READ_STDIN && shared) {
+         if (leader_comm != MPI_COMM_NULL) {
+            Read_vector(node_x, node_n, n, "x", leader_rank, leader_comm);
+            Read_vector(node_y, node_n, n, "y", leader_rank, leader_comm);
+         }
+         Node_sync(x_win, node_comm);
+         Node_sync(y_win, node_comm);
+         phase_ms[SCATTER] = Lap_ms(&lap);
+      } else if (input == READ_STDIN) {
+         Read_vector(local_x, local_n, n, "x", my_rank, comm);
+         //Print_vector(local_x, local_n, n, "x is", my_rank, comm);
+         Read_vector(local_y, local_n, n, "y", my_rank, comm);
+         //Print_vector(local_y, local_n, n, "y is", my_rank, comm);
+         phase_ms[SCATTER] = Lap_ms(&lap);
+      } else if (input == PIPE_STDIN) {
+         // Lectura, distribución, suma y regreso de z solapados
+         Pipeline_vector_sum(local_x, local_y, local_z, z, local_n, n,
+               tile, phase_ms, my_rank, comm);
+      } else if (input == READ_FILES) {
+         Read_vector_file(&x_fh, local_x, local_n, n, my_rank, comm);
+         Read_vector_file(&y_fh, local_y, local_n, n, my_rank, comm);
+         phase_ms[READ] = Lap_ms(&lap);
+      } else {
+         Generate_vector(local_x, local_first, local_n);
+         Generate_vector(local_y, local_first, local_n);
+         phase_ms[INIT] = Lap_ms(&lap);
+      }
 
-   Parallel_vector_sum(local_x, local_y, local_z, local_n);
+      if (input != PIPE_STDIN) {
+         Parallel_vector_sum(local_x, local_y, local_z, local_n);
+         phase_ms[COMPUTE] = Lap_ms(&lap);
+      }
+      if (input == READ_FILES) {
+         Write_vector_file(files[2], local_z, local_n, n, my_rank, comm);
+         phase_ms[WRITE] = Lap_ms(&lap);
+      }
+   }
    tend = MPI_Wtime();
 
-   //Print_vector(local_z, local_n, n, "The sum is", my_rank, comm);
+   if (input == READ_STDIN && shared) {
+      Node_sync(z_win, node_comm);
+      if (leader_comm != MPI_COMM_NULL)
+         Print_vector(node_z, node_n, n, "The sum is", leader_rank,
+               leader_comm);
+   } else if (input == READ_STDIN) {
+      Print_vector(local_z, local_n, n, "The sum is", my_rank, comm);
+   } else if (input == PIPE_STDIN && my_rank == 0) {
+      Print_values(z, n, "The sum is");
+   }
    if(my_rank==0)
     printf("\nTook %f ms to run\n", (tend-tstart)*1000);
+   Report_phases(phase_ms, n, 1, my_rank, comm);
 
-   free(local_x);
-   free(local_y);
-   free(local_z);
+   if (shared) {
+      MPI_Win_unlock_all(x_win);
+      MPI_Win_unlock_all(y_win);
+      MPI_Win_unlock_all(z_win);
+      MPI_Win_free(&x_win);
+      MPI_Win_free(&y_win);
+      MPI_Win_free(&z_win);
+      if (leader_comm != MPI_COMM_NULL) MPI_Comm_free(&leader_comm);
+      MPI_Comm_free(&node_comm);
+   } else {
+      free(local_x);
+      free(local_y);
+      free(local_z);
+   }
+   free(z);
 
    MPI_Finalize();
 
@@ -117,6 +304,92 @@ void Check_for_error(
 }  /* Check_for_error */
 
 
+/*-------------------------------------------------------------------
+ * Function:  Get_args
+ * Purpose:   Get the command line arguments on proc 0 and broadcast
+ *            them to the other processes
+ * In args:   argc, argv:  command line arguments
+ *            my_rank:     process rank in communicator
+ *            comm:        communicator containing all the processes
+ * Out args:  n_p:      order of the vectors when they are generated
+ *                      (default 10000000)
+ *            input_p:  GENERATE, READ_STDIN (-i), PIPE_STDIN (-p),
+ *                      READ_FILES (-f) or STREAM_FILES (-s)
+ *            shared_p: 1 if -w (node shared memory) was given first
+ *            tile_p:   with -s, the number of elements per tile; with
+ *                      -p, per chunk
+ *            files:    with -f or -s, the names of the x, y and z files
+ *
+ * Errors:    n should be positive, -f needs three file names, -s a
+ *            tile size between 1 and MAX_MSG_COUNT and three file
+ *            names, and the names should be shorter than MAX_NAME.
+ *            -p needs a chunk size between 1 and MAX_MSG_COUNT.
+ *            -w only goes with generated or -i input.
+ */
+void Get_args(
+      int         argc               /* in  */,
+      char*       argv[]             /* in  */,
+      long long*  n_p                /* out */,
+      int*        input_p            /* out */,
+      int*        shared_p           /* out */,
+      long long*  tile_p             /* out */,
+      char        files[][MAX_NAME]  /* out */,
+      int         my_rank            /* in  */,
+      MPI_Comm    comm               /* in  */) {
+   int local_ok = 1, i, first_file = 2;
+   char *fname = "Get_args";
+
+   if (my_rank == 0) {
+      *input_p = GENERATE;
+      *n_p = 10000000;
+      *tile_p = 0;
+      *shared_p = argc > 1 && strcmp(argv[1], "-w") == 0;
+      if (*shared_p) {
+         argc--;
+         argv++;
+      }
+      if (argc > 1 && strcmp(argv[1], "-i") == 0) {
+         *input_p = READ_STDIN;
+      } else if (argc > 1 && strcmp(argv[1], "-p") == 0) {
+         *input_p = PIPE_STDIN;
+         if (argc == 3) *tile_p = strtoll(argv[2], NULL, 10);
+         if (*tile_p <= 0 || *tile_p > MAX_MSG_COUNT) local_ok = 0;
+      } else if (argc > 1 && (strcmp(argv[1], "-f") == 0
+               || strcmp(argv[1], "-s") == 0)) {
+         *input_p = READ_FILES;
+         if (argv[1][1] == 's') {
+            *input_p = STREAM_FILES;
+            first_file = 3;
+            if (argc > 2) *tile_p = strtoll(argv[2], NULL, 10);
+            if (*tile_p <= 0 || *tile_p > MAX_MSG_COUNT) local_ok = 0;
+         }
+         if (argc != first_file + 3) local_ok = 0;
+         for (i = 0; i < 3 && local_ok; i++) {
+            if (strlen(argv[first_file+i]) >= MAX_NAME) local_ok = 0;
+            else strcpy(files[i], argv[first_file+i]);
+         }
+      } else if (argc > 1) {
+         *n_p = strtoll(argv[1], NULL, 10);
+      }
+   }
+   Check_for_error(local_ok, fname, "usage: -f <x file> <y file> <z file>"
+         ", -s <tile> <x file> <y file> <z file> or -p <chunk>", comm);
+   MPI_Bcast(shared_p, 1, MPI_INT, 0, comm);
+   MPI_Bcast(input_p, 1, MPI_INT, 0, comm);
+   if (*shared_p && (*input_p == READ_FILES || *input_p == STREAM_FILES
+            || *input_p == PIPE_STDIN))
+      local_ok = 0;
+   Check_for_error(local_ok, fname, "-w can't be used with -f, -s or -p",
+         comm);
+   MPI_Bcast(n_p, 1, MPI_LONG_LONG, 0, comm);
+   MPI_Bcast(tile_p, 1, MPI_LONG_LONG, 0, comm);
+   if (*input_p == READ_FILES || *input_p == STREAM_FILES)
+      MPI_Bcast(files, 3*MAX_NAME, MPI_CHAR, 0, comm);
+   if (*n_p <= 0) local_ok = 0;
+   Check_for_error(local_ok, fname, "n should be > 0", comm);
+}  /* Get_args */
+
+
 /*-------------------------------------------------------------------
  * Function:  Read_n
  * Purpose:   Get the order of the vectors from stdin on proc 0 and
@@ -126,28 +399,27 @@ void Check_for_error(
  *            comm:       communicator containing all the processes
  *                        calling Read_n
  * Out args:  n_p:        global value of n
- *            local_n_p:  local value of n = n/comm_sz
+ *            local_n_p:  number of elements in this process' block
  *
- * Errors:    n should be positive and evenly divisible by comm_sz
+ * Errors:    n should be positive
  */
 void Read_n(
-      int*      n_p        /* out */,
-      int*      local_n_p  /* out */,
-      int       my_rank    /* in  */,
-      int       comm_sz    /* in  */,
-      MPI_Comm  comm       /* in  */) {
+      long long*  n_p        /* out */,
+      long long*  local_n_p  /* out */,
+      int         my_rank    /* in  */,
+      int         comm_sz    /* in  */,
+      MPI_Comm    comm       /* in  */) {
    int local_ok = 1;
    char *fname = "Read_n";
 
    if (my_rank == 0) {
       printf("What's the order of the vectors?\n");
-      scanf("%d", n_p);
+      scanf("%lld", n_p);
    }
-   MPI_Bcast(n_p, 1, MPI_INT, 0, comm);
-   if (*n_p <= 0 || *n_p % comm_sz != 0) local_ok = 0;
-   Check_for_error(local_ok, fname,
-         "n should be > 0 and evenly divisible by comm_sz", comm);
-   *local_n_p = *n_p/comm_sz;
+   MPI_Bcast(n_p, 1, MPI_LONG_LONG, 0, comm);
+   if (*n_p <= 0) local_ok = 0;
+   Check_for_error(local_ok, fname, "n should be > 0", comm);
+   *local_n_p = Block_size(*n_p, comm_sz, my_rank);
 }  /* Read_n */
 
 
@@ -162,20 +434,20 @@ void Read_n(
  * Errors:    One or more of the calls to malloc fails
  */
 void Allocate_vectors(
-      double**   local_x_pp  /* out */,
-      double**   local_y_pp  /* out */,
-      double**   local_z_pp  /* out */,
-      int        local_n     /* in  */,
+      elem_t**   local_x_pp  /* out */,
+      elem_t**   local_y_pp  /* out */,
+      elem_t**   local_z_pp  /* out */,
+      long long  local_n     /* in  */,
       MPI_Comm   comm        /* in  */) {
    int local_ok = 1;
    char* fname = "Allocate_vectors";
 
-   *local_x_pp = malloc(local_n*sizeof(double));
-   *local_y_pp = malloc(local_n*sizeof(double));
-   *local_z_pp = malloc(local_n*sizeof(double));
+   *local_x_pp = malloc((size_t) local_n*sizeof(elem_t));
+   *local_y_pp = malloc((size_t) local_n*sizeof(elem_t));
+   *local_z_pp = malloc((size_t) local_n*sizeof(elem_t));
 
-   if (*local_x_pp == NULL || *local_y_pp == NULL ||
-       *local_z_pp == NULL) local_ok = 0;
+   if (local_n > 0 && (*local_x_pp == NULL || *local_y_pp == NULL ||
+       *local_z_pp == NULL)) local_ok = 0;
    Check_for_error(local_ok, fname, "Can't allocate local vector(s)",
          comm);
 }  /* Allocate_vectors */
@@ -196,49 +468,66 @@ void Allocate_vectors(
  *             fails the program terminates
  *
  * Note:
- *    This function assumes a block distribution and the order
- *   of the vector evenly divisible by comm_sz.
+ *    This function assumes the balanced block distribution computed
+ *    by Block_size and Block_first.
  */
 void Read_vector(
-      double    local_a[]   /* out */,
-      int       local_n     /* in  */,
-      int       n           /* in  */,
-      char      vec_name[]  /* in  */,
-      int       my_rank     /* in  */,
-      MPI_Comm  comm        /* in  */) {
-
-   double* a = NULL;
-   int i;
+      elem_t     local_a[]   /* out */,
+      long long  local_n     /* in  */,
+      long long  n           /* in  */,
+      char       vec_name[]  /* in  */,
+      int        my_rank     /* in  */,
+      MPI_Comm   comm        /* in  */) {
+
+   elem_t* a = NULL;
+   long long i;
    int local_ok = 1;
    char* fname = "Read_vector";
 
    if (my_rank == 0) {
-      a = malloc(n*sizeof(double));
+      a = malloc((size_t) n*sizeof(elem_t));
       if (a == NULL) local_ok = 0;
       Check_for_error(local_ok, fname, "Can't allocate temporary vector",
             comm);
-      //printf("Enter the vector %s\n", vec_name);
-      //fill vec with indez
+      printf("Enter the vector %s\n", vec_name);
       for (i = 0; i < n; i++)
-         a[i] = i;
-      MPI_Scatter(a, local_n, MPI_DOUBLE, local_a, local_n, MPI_DOUBLE, 0,
-         comm);
+         scanf(ELEM_SCAN, &a[i]);
+      Scatter_blocks(a, local_a, local_n, n, my_rank, comm);
       free(a);
    } else {
       Check_for_error(local_ok, fname, "Can't allocate temporary vector",
             comm);
-      MPI_Scatter(a, local_n, MPI_DOUBLE, local_a, local_n, MPI_DOUBLE, 0,
-         comm);
+      Scatter_blocks(a, local_a, local_n, n, my_rank, comm);
    }
 }  /* Read_vector */
 
 
+/*-------------------------------------------------------------------
+ * Function:   Generate_vector
+ * Purpose:    Fill this process' block of the vector (0, 1, ..., n-1)
+ *             directly from its global offset, without communication
+ *             or a staging buffer on process 0
+ * In args:    local_first:  global index of the block's first element
+ *             local_n:      size of local vectors
+ * Out arg:    local_a:      local block of the vector
+ */
+void Generate_vector(
+      elem_t     local_a[]    /* out */,
+      long long  local_first  /* in  */,
+      long long  local_n      /* in  */) {
+   long long local_i;
+
+   for (local_i = 0; local_i < local_n; local_i++)
+      local_a[local_i] = local_first + local_i;
+}  /* Generate_vector */
+
+
 /*-------------------------------------------------------------------
  * Function:  Print_vector
  * Purpose:   Print a vector that has a block distribution to stdout
  * In args:   local_b:  local storage for vector to be printed
  *            local_n:  order of local vectors
- *            n:        order of global vector (local_n*comm_sz)
+ *            n:        order of global vector
  *            title:    title to precede print out
  *            comm:     communicator containing processes calling
  *                      Print_vector
@@ -247,43 +536,662 @@ void Read_vector(
  *            the full vector, the program terminates.
  *
  * Note:
- *    Assumes order of vector is evenly divisible by the number of
- *    processes
+ *    Assumes the balanced block distribution computed by Block_size
+ *    and Block_first
  */
 void Print_vector(
-      double    local_b[]  /* in */,
-      int       local_n    /* in */,
-      int       n          /* in */,
-      char      title[]    /* in */,
-      int       my_rank    /* in */,
-      MPI_Comm  comm       /* in */) {
+      elem_t     local_b[]  /* in */,
+      long long  local_n    /* in */,
+      long long  n          /* in */,
+      char       title[]    /* in */,
+      int        my_rank    /* in */,
+      MPI_Comm   comm       /* in */) {
 
-   double* b = NULL;
-   int i;
+   elem_t* b = NULL;
    int local_ok = 1;
    char* fname = "Print_vector";
 
    if (my_rank == 0) {
-      b = malloc(n*sizeof(double));
+      b = malloc((size_t) n*sizeof(elem_t));
       if (b == NULL) local_ok = 0;
       Check_for_error(local_ok, fname, "Can't allocate temporary vector",
             comm);
-      MPI_Gather(local_b, local_n, MPI_DOUBLE, b, local_n, MPI_DOUBLE,
-            0, comm);
-      printf("%s\n", title);
-      for (i = 0; i < n; i++)
-         printf("%f ", b[i]);
-      printf("\n");
+      Gather_blocks(local_b, b, local_n, n, my_rank, comm);
+      Print_values(b, n, title);
       free(b);
    } else {
       Check_for_error(local_ok, fname, "Can't allocate temporary vector",
             comm);
-      MPI_Gather(local_b, local_n, MPI_DOUBLE, b, local_n, MPI_DOUBLE, 0,
-         comm);
+      Gather_blocks(local_b, b, local_n, n, my_rank, comm);
    }
 }  /* Print_vector */
 
 
+/*-------------------------------------------------------------------
+ * Function:  Print_values
+ * Purpose:   Print a whole vector, held by the calling process, to
+ *            stdout after a title
+ */
+void Print_values(
+      elem_t     b[]      /* in */,
+      long long  n        /* in */,
+      char       title[]  /* in */) {
+   long long i;
+
+   printf("%s\n", title);
+   for (i = 0; i < n; i++)
+      printf(ELEM_FMT " ", b[i]);
+   printf("\n");
+}  /* Print_values */
+
+
+/*-------------------------------------------------------------------
+ * Function:  Open_vector_file
+ * Purpose:   Open a binary vector file on all the processes, check
+ *            its header on process 0 and broadcast its order
+ * In args:   file:     name of the file
+ *            my_rank:  calling process' rank in comm
+ *            comm:     communicator containing calling processes
+ * Out args:  fh_p:     the open file, for Read_vector_file
+ *            n_p:      order of the vector in the file
+ *
+ * Errors:    the file can't be opened, or its header is bad or doesn't
+ *            match its size
+ */
+void Open_vector_file(
+      char        file[]  /* in  */,
+      MPI_File*   fh_p    /* out */,
+      long long*  n_p     /* out */,
+      int         my_rank /* in  */,
+      MPI_Comm    comm    /* in  */) {
+   int local_ok = 1;
+   char* fname = "Open_vector_file";
+   Vec_header h;
+   MPI_Offset size;
+
+   if (MPI_File_open(comm, file, MPI_MODE_RDONLY, MPI_INFO_NULL, fh_p)
+         != MPI_SUCCESS) local_ok = 0;
+   Check_for_error(local_ok, fname, "Can't open vector file", comm);
+
+   *n_p = 0;
+   if (my_rank == 0) {
+      MPI_File_get_size(*fh_p, &size);
+      if (size >= VEC_HEADER_SIZE
+            && MPI_File_read_at(*fh_p, 0, &h, sizeof(h), MPI_BYTE,
+               MPI_STATUS_IGNORE) == MPI_SUCCESS
+            && memcmp(h.magic, VEC_MAGIC, sizeof(h.magic)) == 0
+            && h.dtype == ELEM_DTYPE && h.elem_size == sizeof(elem_t)
+            && h.n > 0
+            && size == VEC_HEADER_SIZE + h.n*(MPI_Offset) sizeof(elem_t))
+         *n_p = h.n;
+   }
+   MPI_Bcast(n_p, 1, MPI_LONG_LONG, 0, comm);
+   if (*n_p <= 0) local_ok = 0;
+   Check_for_error(local_ok, fname, "Bad vector header or size", comm);
+}  /* Open_vector_file */
+
+
+/*-------------------------------------------------------------------
+ * Function:  Read_vector_file
+ * Purpose:   Read this process' block of a vector from a file opened
+ *            by Open_vector_file, and close the file
+ * In args:   local_n:  number of elements in this process' block
+ *            n:        order of global vector
+ *            my_rank:  calling process' rank in comm
+ *            comm:     communicator containing calling processes
+ * In/out arg:  fh_p:   the open file, closed on return
+ * Out arg:   local_a:  this process' block of the vector
+ *
+ * Note:
+ *    Every process reads its own block with collective
+ *    MPI_File_read_at_all, so the MPI library can aggregate the
+ *    requests and no process handles more than its block.  Without
+ *    MPI-4 large counts the read is split into calls of at most
+ *    MAX_MSG_COUNT elements; every process makes the same number of
+ *    calls, since they are collective.
+ */
+void Read_vector_file(
+      MPI_File*  fh_p       /* in/out */,
+      elem_t     local_a[]  /* out    */,
+      long long  local_n    /* in     */,
+      long long  n          /* in     */,
+      int        my_rank    /* in     */,
+      MPI_Comm   comm       /* in     */) {
+   int comm_sz;
+   MPI_Offset offset;
+#  if MPI_VERSION < 4
+   long long done, chunk, max_n;
+#  endif
+
+   MPI_Comm_size(comm, &comm_sz);
+   offset = VEC_HEADER_SIZE
+      + Block_first(n, comm_sz, my_rank)*(MPI_Offset) sizeof(elem_t);
+#  if MPI_VERSION >= 4
+   MPI_File_read_at_all_c(*fh_p, offset, local_a, local_n, MPI_ELEM,
+         MPI_STATUS_IGNORE);
+#  else
+   max_n = Block_size(n, comm_sz, 0);
+   for (done = 0; done < max_n; done += MAX_MSG_COUNT) {
+      chunk = local_n - done < MAX_MSG_COUNT ? local_n - done
+         : MAX_MSG_COUNT;
+      if (chunk < 0) chunk = 0;
+      MPI_File_read_at_all(*fh_p, offset + done*(MPI_Offset) sizeof(elem_t),
+            local_a + done, (int) chunk, MPI_ELEM, MPI_STATUS_IGNORE);
+   }
+#  endif
+   MPI_File_close(fh_p);
+}  /* Read_vector_file */
+
+
+/*-------------------------------------------------------------------
+ * Function:  Write_vector_file
+ * Purpose:   Write a block distributed vector to a binary vector file,
+ *            each process writing its own block
+ * In args:   file:     name of the file (created or truncated)
+ *            local_b:  this process' block of the vector
+ *            local_n:  number of elements in this process' block
+ *            n:        order of global vector
+ *            my_rank:  calling process' rank in comm
+ *            comm:     communicator containing calling processes
+ *
+ * Errors:    the file can't be created
+ *
+ * Note:
+ *    The blocks are written with collective MPI_File_write_at_all,
+ *    split as in Read_vector_file.
+ */
+void Write_vector_file(
+      char       file[]     /* in */,
+      elem_t     local_b[]  /* in */,
+      long long  local_n    /* in */,
+      long long  n          /* in */,
+      int        my_rank    /* in */,
+      MPI_Comm   comm       /* in */) {
+   int comm_sz;
+   MPI_File fh;
+   MPI_Offset offset;
+#  if MPI_VERSION < 4
+   long long done, chunk, max_n;
+#  endif
+
+   MPI_Comm_size(comm, &comm_sz);
+   Create_vector_file(file, &fh, n, my_rank, comm);
+
+   offset = VEC_HEADER_SIZE
+      + Block_first(n, comm_sz, my_rank)*(MPI_Offset) sizeof(elem_t);
+#  if MPI_VERSION >= 4
+   MPI_File_write_at_all_c(fh, offset, local_b, local_n, MPI_ELEM,
+         MPI_STATUS_IGNORE);
+#  else
+   max_n = Block_size(n, comm_sz, 0);
+   for (done = 0; done < max_n; done += MAX_MSG_COUNT) {
+      chunk = local_n - done < MAX_MSG_COUNT ? local_n - done
+         : MAX_MSG_COUNT;
+      if (chunk < 0) chunk = 0;
+      MPI_File_write_at_all(fh, offset + done*(MPI_Offset) sizeof(elem_t),
+            local_b + done, (int) chunk, MPI_ELEM, MPI_STATUS_IGNORE);
+   }
+#  endif
+   MPI_File_close(&fh);
+}  /* Write_vector_file */
+
+
+/*-------------------------------------------------------------------
+ * Function:  Create_vector_file
+ * Purpose:   Create (or truncate) a binary vector file for n elements
+ *            on all the processes; process 0 writes the header
+ * In args:   file:     name of the file
+ *            n:        order of global vector
+ *            my_rank:  calling process' rank in comm
+ *            comm:     communicator containing calling processes
+ * Out arg:   fh_p:     the open file
+ *
+ * Errors:    the file can't be created
+ */
+void Create_vector_file(
+      char       file[]   /* in  */,
+      MPI_File*  fh_p     /* out */,
+      long long  n        /* in  */,
+      int        my_rank  /* in  */,
+      MPI_Comm   comm     /* in  */) {
+   int local_ok = 1;
+   char* fname = "Create_vector_file";
+   char header[VEC_HEADER_SIZE];
+   Vec_header h;
+
+   if (MPI_File_open(comm, file, MPI_MODE_WRONLY | MPI_MODE_CREATE,
+         MPI_INFO_NULL, fh_p) != MPI_SUCCESS) local_ok = 0;
+   Check_for_error(local_ok, fname, "Can't create vector file", comm);
+   MPI_File_set_size(*fh_p,
+         VEC_HEADER_SIZE + n*(MPI_Offset) sizeof(elem_t));
+
+   if (my_rank == 0) {
+      memset(header, 0, VEC_HEADER_SIZE);
+      memcpy(h.magic, VEC_MAGIC, sizeof(h.magic));
+      h.n = n;
+      h.dtype = ELEM_DTYPE;
+      h.elem_size = sizeof(elem_t);
+      memcpy(header, &h, sizeof(h));
+      MPI_File_write_at(*fh_p, 0, header, VEC_HEADER_SIZE, MPI_BYTE,
+            MPI_STATUS_IGNORE);
+   }
+}  /* Create_vector_file */
+
+
+/*-------------------------------------------------------------------
+ * Function:  Stream_vector_sum
+ * Purpose:   Add this process' blocks of two vector files tile by
+ *            tile and write the sum to a new vector file, without
+ *            holding the blocks in memory
+ * In args:   z_file:   name of the sum file (created or truncated)
+ *            n:        order of global vector
+ *            tile:     elements per tile, at most MAX_MSG_COUNT
+ *            my_rank:  calling process' rank in comm
+ *            comm:     communicator containing calling processes
+ * In/out args:  x_fh_p, y_fh_p:  files opened by Open_vector_file,
+ *               closed on return
+ *            phase_ms: time spent allocating, waiting for reads,
+ *               computing and waiting for writes is added to the
+ *               ALLOC, READ, COMPUTE and WRITE entries
+ *
+ * Errors:    the tiles can't be allocated, or z_file can't be created
+ *
+ * Note:
+ *    x, y and z each have two tile buffers.  While tile t is added,
+ *    tile t+1 of x and y is being read and tile t-1 of z written with
+ *    nonblocking MPI_File_iread_at/MPI_File_iwrite_at, so I/O
+ *    overlaps the computation and memory use is 6*tile elements per
+ *    process whatever n is.  READ and WRITE only count time spent
+ *    waiting, i.e. I/O that wasn't hidden.
+ */
+void Stream_vector_sum(
+      MPI_File*  x_fh_p      /* in/out */,
+      MPI_File*  y_fh_p      /* in/out */,
+      char       z_file[]    /* in     */,
+      long long  n           /* in     */,
+      long long  tile        /* in     */,
+      double     phase_ms[]  /* in/out */,
+      int        my_rank     /* in     */,
+      MPI_Comm   comm        /* in     */) {
+   int comm_sz, b, local_ok = 1;
+   char* fname = "Stream_vector_sum";
+   long long local_n, start, count, next;
+   elem_t *x_buf[2], *y_buf[2], *z_buf[2];
+   MPI_Request x_req[2] = {MPI_REQUEST_NULL, MPI_REQUEST_NULL};
+   MPI_Request y_req[2] = {MPI_REQUEST_NULL, MPI_REQUEST_NULL};
+   MPI_Request z_req[2] = {MPI_REQUEST_NULL, MPI_REQUEST_NULL};
+   MPI_File z_fh;
+   MPI_Offset offset;
+   double lap = MPI_Wtime();
+
+   MPI_Comm_size(comm, &comm_sz);
+   local_n = Block_size(n, comm_sz, my_rank);
+   offset = VEC_HEADER_SIZE
+      + Block_first(n, comm_sz, my_rank)*(MPI_Offset) sizeof(elem_t);
+   if (tile > local_n) tile = local_n;
+   for (b = 0; b < 2; b++) {
+      x_buf[b] = malloc((size_t) tile*sizeof(elem_t));
+      y_buf[b] = malloc((size_t) tile*sizeof(elem_t));
+      z_buf[b] = malloc((size_t) tile*sizeof(elem_t));
+      if (tile > 0 && (x_buf[b] == NULL || y_buf[b] == NULL
+               || z_buf[b] == NULL)) local_ok = 0;
+   }
+   Check_for_error(local_ok, fname, "Can't allocate tiles", comm);
+   Create_vector_file(z_file, &z_fh, n, my_rank, comm);
+   phase_ms[ALLOC] += Lap_ms(&lap);
+
+   if (local_n > 0) {
+      MPI_File_iread_at(*x_fh_p, offset, x_buf[0], (int) tile,
+            MPI_ELEM, &x_req[0]);
+      MPI_File_iread_at(*y_fh_p, offset, y_buf[0], (int) tile,
+            MPI_ELEM, &y_req[0]);
+   }
+   for (start = 0, b = 0; start < local_n; start += count, b = 1 - b) {
+      count = local_n - start < tile ? local_n - start : tile;
+      MPI_Wait(&x_req[b], MPI_STATUS_IGNORE);
+      MPI_Wait(&y_req[b], MPI_STATUS_IGNORE);
+      next = start + count;
+      if (next < local_n) {
+         MPI_Offset next_offset = offset + next*(MPI_Offset) sizeof(elem_t);
+         int next_count = local_n - next < tile ? local_n - next : tile;
+
+         MPI_File_iread_at(*x_fh_p, next_offset, x_buf[1-b], next_count,
+               MPI_ELEM, &x_req[1-b]);
+         MPI_File_iread_at(*y_fh_p, next_offset, y_buf[1-b], next_count,
+               MPI_ELEM, &y_req[1-b]);
+      }
+      phase_ms[READ] += Lap_ms(&lap);
+
+      /* z_buf[b] was last written two tiles ago */
+      MPI_Wait(&z_req[b], MPI_STATUS_IGNORE);
+      phase_ms[WRITE] += Lap_ms(&lap);
+
+      Parallel_vector_sum(x_buf[b], y_buf[b], z_buf[b], count);
+      phase_ms[COMPUTE] += Lap_ms(&lap);
+
+      MPI_File_iwrite_at(z_fh, offset + start*(MPI_Offset) sizeof(elem_t),
+            z_buf[b], (int) count, MPI_ELEM, &z_req[b]);
+   }
+   MPI_Waitall(2, z_req, MPI_STATUSES_IGNORE);
+   MPI_File_close(&z_fh);
+   MPI_File_close(x_fh_p);
+   MPI_File_close(y_fh_p);
+   phase_ms[WRITE] += Lap_ms(&lap);
+
+   for (b = 0; b < 2; b++) {
+      free(x_buf[b]);
+      free(y_buf[b]);
+      free(z_buf[b]);
+   }
+}  /* Stream_vector_sum */
+
+
+/*-------------------------------------------------------------------
+ * Function:  Pipeline_vector_sum
+ * Purpose:   Read x and y from stdin on process 0 and add them, with
+ *            the reading, the distribution, the addition and the
+ *            return of z overlapped chunk by chunk
+ * In args:   local_n:  number of elements in this process' block
+ *            n:        order of global vector
+ *            chunk:    elements per chunk, at most MAX_MSG_COUNT
+ *            my_rank:  calling process' rank in comm
+ *            comm:     communicator containing calling processes
+ * Out args:  local_x, local_y, local_z:  this process' blocks
+ *            z:        on process 0, the whole sum (unused elsewhere)
+ * In/out arg:  phase_ms:  time spent adding is added to COMPUTE, the
+ *               rest (reading and communication not hidden behind
+ *               it) to SCATTER
+ *
+ * Errors:    process 0 can't allocate its chunk buffers, or a process
+ *            its requests
+ *
+ * Note:
+ *    The vectors are cut at multiples of chunk, and a block at those
+ *    cuts into pieces (see Piece).  Process 0 reads one chunk of x or
+ *    y at a time and sends each piece to its owner with MPI_Isend
+ *    right away, keeping up to PIPE_DEPTH chunks in flight.  The other
+ *    processes post all their receives straight into their blocks
+ *    first, add each piece as soon as its y has arrived, and send the
+ *    piece of z back with MPI_Isend, into receives process 0 posted at
+ *    the start.  So the last process can be adding while process 0 is
+ *    still reading, and the sum is back on process 0 a piece after it
+ *    has read y:  the time is close to the longest of reading,
+ *    communicating and adding instead of their sum.  Unlike -i, the
+ *    time includes gathering z.
+ */
+void Pipeline_vector_sum(
+      elem_t     local_x[]   /* out    */,
+      elem_t     local_y[]   /* out    */,
+      elem_t     local_z[]   /* out    */,
+      elem_t     z[]         /* out    */,
+      long long  local_n     /* in     */,
+      long long  n           /* in     */,
+      long long  chunk       /* in     */,
+      double     phase_ms[]  /* in/out */,
+      int        my_rank     /* in     */,
+      MPI_Comm   comm        /* in     */) {
+   int comm_sz, q, v, slot, local_ok = 1;
+   char* fname = "Pipeline_vector_sum";
+   long long local_first, pieces, i, j, k, start, count, first, last;
+   elem_t *buf = NULL, *vec;
+   double t, compute_ms = 0;
+   double start_time = MPI_Wtime();
+   MPI_Request *send_reqs = NULL, *recv_reqs = NULL;
+
+   MPI_Comm_size(comm, &comm_sz);
+   local_first = Block_first(n, comm_sz, my_rank);
+   if (my_rank == 0) {
+      /* A receive for every piece of z outside process 0's block */
+      for (pieces = 0, q = 1; q < comm_sz; q++)
+         pieces += Piece_count(Block_first(n, comm_sz, q),
+               Block_size(n, comm_sz, q), chunk);
+      buf = malloc((size_t) PIPE_DEPTH*chunk*sizeof(elem_t));
+      send_reqs = malloc((size_t) PIPE_DEPTH*comm_sz*sizeof(MPI_Request));
+      recv_reqs = malloc((size_t) (pieces > 0 ? pieces : 1)
+            *sizeof(MPI_Request));
+      if (buf == NULL || send_reqs == NULL || recv_reqs == NULL)
+         local_ok = 0;
+   } else {
+      pieces = Piece_count(local_first, local_n, chunk);
+      recv_reqs = malloc((size_t) (2*pieces > 0 ? 2*pieces : 1)
+            *sizeof(MPI_Request));
+      send_reqs = malloc((size_t) (pieces > 0 ? pieces : 1)
+            *sizeof(MPI_Request));
+      if (recv_reqs == NULL || send_reqs == NULL) local_ok = 0;
+   }
+   Check_for_error(local_ok, fname, "Can't allocate pipeline buffers",
+         comm);
+
+   if (my_rank == 0) {
+      for (k = 0, q = 1; q < comm_sz; q++) {
+         first = Block_first(n, comm_sz, q);
+         count = Block_size(n, comm_sz, q);
+         for (i = 0; i < Piece_count(first, count, chunk); i++, k++) {
+            Piece(first, count, chunk, i, &start, &j);
+            MPI_Irecv(z + start, (int) j, MPI_ELEM, q, Z_TAG, comm,
+                  &recv_reqs[k]);
+         }
+      }
+      for (i = 0; i < PIPE_DEPTH*comm_sz; i++)
+         send_reqs[i] = MPI_REQUEST_NULL;
+
+      for (v = 0; v < 2; v++) {
+         vec = v == 0 ? local_x : local_y;
+         printf("Enter the vector %s\n", v == 0 ? "x" : "y");
+         for (start = 0, slot = 0, q = 0; start < n;
+               start += count, slot = (slot + 1) % PIPE_DEPTH) {
+            count = n - start < chunk ? n - start : chunk;
+            /* The sends from this buffer PIPE_DEPTH chunks ago */
+            MPI_Waitall(comm_sz, send_reqs + slot*comm_sz,
+                  MPI_STATUSES_IGNORE);
+            for (j = 0; j < count; j++)
+               scanf(ELEM_SCAN, &buf[slot*chunk + j]);
+
+            /* Send each owner its piece; the pieces in process 0's
+             * own block are copied, and added once y is there */
+            for (; q < comm_sz; q++) {
+               first = Block_first(n, comm_sz, q);
+               last = first + Block_size(n, comm_sz, q);
+               if (first >= start + count) break;
+               if (first < start) first = start;
+               if (last > start + count) last = start + count;
+               if (q == 0) {
+                  memcpy(vec + first, buf + slot*chunk + first - start,
+                        (size_t) (last - first)*sizeof(elem_t));
+                  if (v == 1) {
+                     t = MPI_Wtime();
+                     Parallel_vector_sum(local_x + first, local_y + first,
+                           local_z + first, last - first);
+                     compute_ms += (MPI_Wtime() - t)*1000;
+                  }
+               } else {
+                  MPI_Isend(buf + slot*chunk + first - start,
+                        (int) (last - first), MPI_ELEM, q,
+                        v == 0 ? X_TAG : Y_TAG, comm,
+                        &send_reqs[slot*comm_sz + q]);
+               }
+               if (last < Block_first(n, comm_sz, q)
+                     + Block_size(n, comm_sz, q)) break;
+            }
+         }
+      }
+      MPI_Waitall(PIPE_DEPTH*comm_sz, send_reqs, MPI_STATUSES_IGNORE);
+      MPI_Waitall((int) pieces, recv_reqs, MPI_STATUSES_IGNORE);
+      memcpy(z, local_z, (size_t) local_n*sizeof(elem_t));
+   } else {
+      for (i = 0; i < pieces; i++) {
+         Piece(local_first, local_n, chunk, i, &start, &count);
+         start -= local_first;
+         MPI_Irecv(local_x + start, (int) count, MPI_ELEM, 0, X_TAG,
+               comm, &recv_reqs[2*i]);
+         MPI_Irecv(local_y + start, (int) count, MPI_ELEM, 0, Y_TAG,
+               comm, &recv_reqs[2*i+1]);
+      }
+      for (i = 0; i < pieces; i++) {
+         Piece(local_first, local_n, chunk, i, &start, &count);
+         start -= local_first;
+         MPI_Waitall(2, recv_reqs + 2*i, MPI_STATUSES_IGNORE);
+         t = MPI_Wtime();
+         Parallel_vector_sum(local_x + start, local_y + start,
+               local_z + start, count);
+         compute_ms += (MPI_Wtime() - t)*1000;
+         MPI_Isend(local_z + start, (int) count, MPI_ELEM, 0, Z_TAG,
+               comm, &send_reqs[i]);
+      }
+      MPI_Waitall((int) pieces, send_reqs, MPI_STATUSES_IGNORE);
+   }
+   phase_ms[COMPUTE] += compute_ms;
+   phase_ms[SCATTER] += (MPI_Wtime() - start_time)*1000 - compute_ms;
+
+   free(buf);
+   free(send_reqs);
+   free(recv_reqs);
+}  /* Pipeline_vector_sum */
+
+
+/*-------------------------------------------------------------------
+ * Function:  Piece_count
+ * Purpose:   Number of pieces the elements first, ..., first+count-1
+ *            are cut into at the multiples of chunk
+ */
+long long Piece_count(
+      long long  first  /* in */,
+      long long  count  /* in */,
+      long long  chunk  /* in */) {
+   if (count <= 0) return 0;
+   return (first + count - 1)/chunk - first/chunk + 1;
+}  /* Piece_count */
+
+
+/*-------------------------------------------------------------------
+ * Function:  Piece
+ * Purpose:   Find piece i of the elements first, ..., first+count-1
+ *            cut at the multiples of chunk
+ * Out args:  piece_first_p:  global index of the piece's first element
+ *            piece_n_p:      number of elements in the piece
+ */
+void Piece(
+      long long   first          /* in  */,
+      long long   count          /* in  */,
+      long long   chunk          /* in  */,
+      long long   i              /* in  */,
+      long long*  piece_first_p  /* out */,
+      long long*  piece_n_p      /* out */) {
+   long long lo = (first/chunk + i)*chunk, hi = lo + chunk;
+
+   if (lo < first) lo = first;
+   if (hi > first + count) hi = first + count;
+   *piece_first_p = lo;
+   *piece_n_p = hi - lo;
+}  /* Piece */
+
+
+/*-------------------------------------------------------------------
+ * Function:  Split_nodes
+ * Purpose:   Group the processes by node and lay the vectors out so
+ *            that each node's processes hold one contiguous part
+ * In args:   n:              order of global vector
+ *            comm:           communicator containing all processes
+ * Out args:  node_comm_p:    the processes on the caller's node
+ *            leader_comm_p:  one process (node rank 0) per node, in
+ *                            the order of the nodes' parts of the
+ *                            vector; MPI_COMM_NULL on other processes
+ *            node_n_p:       size of the node's part
+ *            local_first_p:  global index of this process' block
+ *            local_n_p:      size of this process' block
+ *
+ * Note:
+ *    Two-level balanced block distribution:  node k gets block k of
+ *    n over the nodes, and the processes on the node split that
+ *    block in node rank order.  The leaders can then scatter and
+ *    gather the node parts with Scatter_blocks/Gather_blocks over
+ *    leader_comm.  Process 0 is the first leader.
+ */
+void Split_nodes(
+      long long   n              /* in  */,
+      MPI_Comm    comm           /* in  */,
+      MPI_Comm*   node_comm_p    /* out */,
+      MPI_Comm*   leader_comm_p  /* out */,
+      long long*  node_n_p       /* out */,
+      long long*  local_first_p  /* out */,
+      long long*  local_n_p      /* out */) {
+   int my_rank, node_rank, node_sz, node_id, node_count;
+   long long node_first;
+
+   MPI_Comm_rank(comm, &my_rank);
+   MPI_Comm_split_type(comm, MPI_COMM_TYPE_SHARED, my_rank, MPI_INFO_NULL,
+         node_comm_p);
+   MPI_Comm_rank(*node_comm_p, &node_rank);
+   MPI_Comm_size(*node_comm_p, &node_sz);
+   MPI_Comm_split(comm, node_rank == 0 ? 0 : MPI_UNDEFINED, my_rank,
+         leader_comm_p);
+   if (node_rank == 0) {
+      MPI_Comm_rank(*leader_comm_p, &node_id);
+      MPI_Comm_size(*leader_comm_p, &node_count);
+   }
+   MPI_Bcast(&node_id, 1, MPI_INT, 0, *node_comm_p);
+   MPI_Bcast(&node_count, 1, MPI_INT, 0, *node_comm_p);
+
+   *node_n_p = Block_size(n, node_count, node_id);
+   node_first = Block_first(n, node_count, node_id);
+   *local_first_p = node_first + Block_first(*node_n_p, node_sz, node_rank);
+   *local_n_p = Block_size(*node_n_p, node_sz, node_rank);
+}  /* Split_nodes */
+
+
+/*-------------------------------------------------------------------
+ * Function:  Allocate_shared_vector
+ * Purpose:   Allocate this process' block of a vector in a shared
+ *            memory window of the node
+ * In args:   local_n:    size of this process' block
+ *            node_comm:  the processes on the node (from Split_nodes)
+ * Out args:  local_a_pp: this process' block
+ *            node_a_pp:  the node's whole part of the vector, the
+ *                        blocks of all the node's processes in node
+ *                        rank order
+ *            win_p:      the window; free with MPI_Win_unlock_all and
+ *                        MPI_Win_free
+ *
+ * Note:
+ *    The window is contiguous across the node's processes (the
+ *    default) and is kept in a passive target epoch (MPI_Win_lock_all)
+ *    so Node_sync can make stores visible to the other processes.
+ *    Allocation failures abort through MPI's default error handler.
+ */
+void Allocate_shared_vector(
+      elem_t**   local_a_pp  /* out */,
+      elem_t**   node_a_pp   /* out */,
+      MPI_Win*   win_p       /* out */,
+      long long  local_n     /* in  */,
+      MPI_Comm   node_comm   /* in  */) {
+   MPI_Aint size;
+   int disp_unit;
+
+   MPI_Win_allocate_shared((MPI_Aint) local_n*sizeof(elem_t),
+         sizeof(elem_t), MPI_INFO_NULL, node_comm, local_a_pp, win_p);
+   /* MPI_PROC_NULL: the first segment with a nonzero size */
+   MPI_Win_shared_query(*win_p, MPI_PROC_NULL, &size, &disp_unit,
+         node_a_pp);
+   MPI_Win_lock_all(MPI_MODE_NOCHECK, *win_p);
+}  /* Allocate_shared_vector */
+
+
+/*-------------------------------------------------------------------
+ * Function:  Node_sync
+ * Purpose:   Make the stores of every process on the node to a shared
+ *            window visible to all of them
+ * In args:   win:        window from Allocate_shared_vector
+ *            node_comm:  the processes on the node
+ */
+void Node_sync(
+      MPI_Win   win        /* in */,
+      MPI_Comm  node_comm  /* in */) {
+   MPI_Win_sync(win);
+   MPI_Barrier(node_comm);
+   MPI_Win_sync(win);
+}  /* Node_sync */
+
+
 /*-------------------------------------------------------------------
  * Function:  Parallel_vector_sum
  * Purpose:   Add a vector that's been distributed among the processes
@@ -294,12 +1202,322 @@ void Print_vector(
  * Out arg:   local_z:  local storage for the sum of the two vectors
  */
 void Parallel_vector_sum(
-      double  local_x[]  /* in  */,
-      double  local_y[]  /* in  */,
-      double  local_z[]  /* out */,
-      int     local_n    /* in  */) {
-   int local_i;
+      elem_t     local_x[]  /* in  */,
+      elem_t     local_y[]  /* in  */,
+      elem_t     local_z[]  /* out */,
+      long long  local_n    /* in  */) {
+   long long local_i;
 
    for (local_i = 0; local_i < local_n; local_i++)
       local_z[local_i] = local_x[local_i] + local_y[local_i];
 }  /* Parallel_vector_sum */
+
+
+/*-------------------------------------------------------------------
+ * Function:  Block_first
+ * Purpose:   Find the global index of the first element assigned to
+ *            process q by the balanced block distribution
+ * In args:   n:        order of global vector
+ *            comm_sz:  number of processes
+ *            q:        rank of the process
+ *
+ * Note:
+ *    The first n % comm_sz processes get n/comm_sz + 1 elements and
+ *    the others get n/comm_sz, so n need not be divisible by comm_sz.
+ */
+long long Block_first(
+      long long  n        /* in */,
+      int        comm_sz  /* in */,
+      int        q        /* in */) {
+   long long quotient = n/comm_sz, remainder = n % comm_sz;
+
+   return q*quotient + (q < remainder ? q : remainder);
+}  /* Block_first */
+
+
+/*-------------------------------------------------------------------
+ * Function:  Block_size
+ * Purpose:   Find the number of elements assigned to process q by the
+ *            balanced block distribution
+ * In args:   n:        order of global vector
+ *            comm_sz:  number of processes
+ *            q:        rank of the process
+ */
+long long Block_size(
+      long long  n        /* in */,
+      int        comm_sz  /* in */,
+      int        q        /* in */) {
+   return n/comm_sz + (q < n % comm_sz ? 1 : 0);
+}  /* Block_size */
+
+
+/*-------------------------------------------------------------------
+ * Function:  Build_counts
+ * Purpose:   Build the counts and displacements arrays used by
+ *            MPI_Scatterv and MPI_Gatherv for the balanced block
+ *            distribution
+ * In args:   n:        order of global vector
+ *            comm_sz:  number of processes
+ * Out args:  counts:   counts[q] = number of elements in q's block
+ *            displs:   displs[q] = global index of q's first element
+ *
+ * Note:
+ *    The caller must make sure n fits in an int.
+ */
+void Build_counts(
+      long long  n         /* in  */,
+      int        comm_sz   /* in  */,
+      int        counts[]  /* out */,
+      int        displs[]  /* out */) {
+   int q;
+
+   for (q = 0; q < comm_sz; q++) {
+      counts[q] = Block_size(n, comm_sz, q);
+      displs[q] = Block_first(n, comm_sz, q);
+   }
+}  /* Build_counts */
+
+
+/*-------------------------------------------------------------------
+ * Function:  Scatter_blocks
+ * Purpose:   Distribute the n elements of a on process 0 among the
+ *            processes using the balanced block distribution
+ * In args:   a:        on process 0, the global vector
+ *            local_n:  number of elements in this process' block
+ *            n:        order of global vector
+ *            my_rank:  calling process' rank in comm
+ *            comm:     communicator containing calling processes
+ * Out arg:   local_a:  this process' block of a
+ *
+ * Note:
+ *    With an MPI-4 library this is a single large-count
+ *    MPI_Scatterv_c.  Older libraries use MPI_Scatterv while n fits in
+ *    an int and fall back to point-to-point messages of at most
+ *    MAX_MSG_COUNT elements beyond that.
+ */
+void Scatter_blocks(
+      elem_t     a[]        /* in  */,
+      elem_t     local_a[]  /* out */,
+      long long  local_n    /* in  */,
+      long long  n          /* in  */,
+      int        my_rank    /* in  */,
+      MPI_Comm   comm       /* in  */) {
+   int comm_sz, q;
+   int local_ok = 1;
+   char* fname = "Scatter_blocks";
+#  if MPI_VERSION >= 4
+   MPI_Count* counts = NULL;
+   MPI_Aint* displs = NULL;
+#  else
+   int* counts = NULL;
+   int* displs = NULL;
+#  endif
+
+   MPI_Comm_size(comm, &comm_sz);
+#  if MPI_VERSION >= 4
+   if (my_rank == 0) {
+      counts = malloc(comm_sz*sizeof(MPI_Count));
+      displs = malloc(comm_sz*sizeof(MPI_Aint));
+      if (counts == NULL || displs == NULL) local_ok = 0;
+   }
+   Check_for_error(local_ok, fname, "Can't allocate counts", comm);
+   if (my_rank == 0)
+      for (q = 0; q < comm_sz; q++) {
+         counts[q] = Block_size(n, comm_sz, q);
+         displs[q] = Block_first(n, comm_sz, q);
+      }
+   MPI_Scatterv_c(a, counts, displs, MPI_ELEM, local_a, local_n,
+         MPI_ELEM, 0, comm);
+#  else
+   if (n <= INT_MAX) {
+      if (my_rank == 0) {
+         counts = malloc(comm_sz*sizeof(int));
+         displs = malloc(comm_sz*sizeof(int));
+         if (counts == NULL || displs == NULL) local_ok = 0;
+      }
+      Check_for_error(local_ok, fname, "Can't allocate counts", comm);
+      if (my_rank == 0) Build_counts(n, comm_sz, counts, displs);
+      MPI_Scatterv(a, counts, displs, MPI_ELEM, local_a, (int) local_n,
+            MPI_ELEM, 0, comm);
+   } else if (my_rank == 0) {
+      memcpy(local_a, a, (size_t) local_n*sizeof(elem_t));
+      for (q = 1; q < comm_sz; q++)
+         Send_large(a + Block_first(n, comm_sz, q),
+               Block_size(n, comm_sz, q), q, comm);
+   } else {
+      Recv_large(local_a, local_n, 0, comm);
+   }
+#  endif
+   free(counts);
+   free(displs);
+}  /* Scatter_blocks */
+
+
+/*-------------------------------------------------------------------
+ * Function:  Gather_blocks
+ * Purpose:   Collect a block distributed vector onto process 0
+ * In args:   local_b:  this process' block of the vector
+ *            local_n:  number of elements in this process' block
+ *            n:        order of global vector
+ *            my_rank:  calling process' rank in comm
+ *            comm:     communicator containing calling processes
+ * Out arg:   b:        on process 0, the global vector
+ *
+ * Note:
+ *    Uses the same large-count strategy as Scatter_blocks.
+ */
+void Gather_blocks(
+      elem_t     local_b[]  /* in  */,
+      elem_t     b[]        /* out */,
+      long long  local_n    /* in  */,
+      long long  n          /* in  */,
+      int        my_rank    /* in  */,
+      MPI_Comm   comm       /* in  */) {
+   int comm_sz, q;
+   int local_ok = 1;
+   char* fname = "Gather_blocks";
+#  if MPI_VERSION >= 4
+   MPI_Count* counts = NULL;
+   MPI_Aint* displs = NULL;
+#  else
+   int* counts = NULL;
+   int* displs = NULL;
+#  endif
+
+   MPI_Comm_size(comm, &comm_sz);
+#  if MPI_VERSION >= 4
+   if (my_rank == 0) {
+      counts = malloc(comm_sz*sizeof(MPI_Count));
+      displs = malloc(comm_sz*sizeof(MPI_Aint));
+      if (counts == NULL || displs == NULL) local_ok = 0;
+   }
+   Check_for_error(local_ok, fname, "Can't allocate counts", comm);
+   if (my_rank == 0)
+      for (q = 0; q < comm_sz; q++) {
+         counts[q] = Block_size(n, comm_sz, q);
+         displs[q] = Block_first(n, comm_sz, q);
+      }
+   MPI_Gatherv_c(local_b, local_n, MPI_ELEM, b, counts, displs,
+         MPI_ELEM, 0, comm);
+#  else
+   if (n <= INT_MAX) {
+      if (my_rank == 0) {
+         counts = malloc(comm_sz*sizeof(int));
+         displs = malloc(comm_sz*sizeof(int));
+         if (counts == NULL || displs == NULL) local_ok = 0;
+      }
+      Check_for_error(local_ok, fname, "Can't allocate counts", comm);
+      if (my_rank == 0) Build_counts(n, comm_sz, counts, displs);
+      MPI_Gatherv(local_b, (int) local_n, MPI_ELEM, b, counts, displs,
+            MPI_ELEM, 0, comm);
+   } else if (my_rank == 0) {
+      memcpy(b, local_b, (size_t) local_n*sizeof(elem_t));
+      for (q = 1; q < comm_sz; q++)
+         Recv_large(b + Block_first(n, comm_sz, q),
+               Block_size(n, comm_sz, q), q, comm);
+   } else {
+      Send_large(local_b, local_n, 0, comm);
+   }
+#  endif
+   free(counts);
+   free(displs);
+}  /* Gather_blocks */
+
+
+/*-------------------------------------------------------------------
+ * Function:  Send_large
+ * Purpose:   Send count elements to dest as a sequence of messages of
+ *            at most MAX_MSG_COUNT elements
+ * In args:   buf:    data to send
+ *            count:  number of elements to send
+ *            dest:   rank of the receiving process
+ *            comm:   communicator containing both processes
+ */
+void Send_large(
+      elem_t     buf[]  /* in */,
+      long long  count  /* in */,
+      int        dest   /* in */,
+      MPI_Comm   comm   /* in */) {
+   long long done, chunk;
+
+   for (done = 0; done < count; done += chunk) {
+      chunk = count - done < MAX_MSG_COUNT ? count - done : MAX_MSG_COUNT;
+      MPI_Send(buf + done, (int) chunk, MPI_ELEM, dest, 0, comm);
+   }
+}  /* Send_large */
+
+
+/*-------------------------------------------------------------------
+ * Function:  Recv_large
+ * Purpose:   Receive count elements sent by Send_large
+ * In args:   count:   number of elements to receive
+ *            source:  rank of the sending process
+ *            comm:    communicator containing both processes
+ * Out arg:   buf:     storage for the received data
+ */
+void Recv_large(
+      elem_t     buf[]   /* out */,
+      long long  count   /* in  */,
+      int        source  /* in  */,
+      MPI_Comm   comm    /* in  */) {
+   long long done, chunk;
+
+   for (done = 0; done < count; done += chunk) {
+      chunk = count - done < MAX_MSG_COUNT ? count - done : MAX_MSG_COUNT;
+      MPI_Recv(buf + done, (int) chunk, MPI_ELEM, source, 0, comm,
+            MPI_STATUS_IGNORE);
+   }
+}  /* Recv_large */
+
+
+/*-------------------------------------------------------------------
+ * Function:  Lap_ms
+ * Purpose:   Return the milliseconds elapsed since *start_p and restart
+ *            the lap at the current time
+ * In/out arg:  start_p:  MPI_Wtime() at the start of the lap
+ */
+double Lap_ms(double* start_p /* in/out */) {
+   double now = MPI_Wtime();
+   double ms = (now - *start_p)*1000;
+
+   *start_p = now;
+   return ms;
+}  /* Lap_ms */
+
+
+/*-------------------------------------------------------------------
+ * Function:  Report_phases
+ * Purpose:   Reduce every process' phase times to their minimum,
+ *            average and maximum and print them on process 0 as one
+ *            JSON line starting with "TIMING "
+ * In args:   phase_ms:  this process' time in each phase (ms)
+ *            n:         order of global vector
+ *            threads:   threads per process
+ *            my_rank:   rank of calling process
+ *            comm:      communicator containing all processes
+ */
+void Report_phases(
+      double     phase_ms[]  /* in */,
+      long long  n           /* in */,
+      int        threads     /* in */,
+      int        my_rank     /* in */,
+      MPI_Comm   comm        /* in */) {
+   double min[PHASE_COUNT], max[PHASE_COUNT], sum[PHASE_COUNT];
+   int comm_sz, p;
+
+   MPI_Comm_size(comm, &comm_sz);
+   MPI_Reduce(phase_ms, min, PHASE_COUNT, MPI_DOUBLE, MPI_MIN, 0, comm);
+   MPI_Reduce(phase_ms, max, PHASE_COUNT, MPI_DOUBLE, MPI_MAX, 0, comm);
+   MPI_Reduce(phase_ms, sum, PHASE_COUNT, MPI_DOUBLE, MPI_SUM, 0, comm);
+
+   if (my_rank == 0) {
+      printf("TIMING {\"program\":\"%s\",\"comm_sz\":%d,\"threads\":%d,"
+            "\"n\":%lld,\"unit\":\"ms\",\"phases\":{", PROGRAM, comm_sz,
+            threads, n);
+      for (p = 0; p < PHASE_COUNT; p++)
+         printf("%s\"%s\":{\"min\":%.3f,\"avg\":%.3f,\"max\":%.3f}",
+               p > 0 ? "," : "", phase_names[p], min[p],
+               sum[p]/comm_sz, max[p]);
+      printf("}}\n");
+   }
+}  /* Report_phases */
@@ -2,34 +2,139 @@
  *
  *
  * Compile:  mpicc -g -Wall -o mpi_vector_add2 mpi_vector_add2.c
- * Run:      mpiexec ./mpi_vector_add2 <number_of_elements>
- * 
+ *           (-DVEC_FLOAT or -DVEC_MIXED for float vectors, see
+ *           vector_type.h)
+ * Run:      mpiexec ./mpi_vector_add2 [-k pairs] <number_of_elements> [seed]
+ *           mpiexec ./mpi_vector_add2 -S <fifo>
+ *
+ * Options:  -k <pairs>  add a batch of <pairs> x+y pairs in one run;
+ *               pair j has a length between 1 and <number_of_elements>
+ *               drawn from the seed (see Batch_layout)
+ *           -S <fifo>   run as a service:  keep the processes and the
+ *               vectors alive and run the jobs written to <fifo>, one
+ *               line each (see Serve and Next_job), e.g.
+ *                  mkfifo reply
+ *                  echo "$PWD/reply -k 100 50000 7" > fifo; cat reply
+ *                  echo quit > fifo
+ *
+ * Notes:
+ * 1.  x and y depend only on the seed (default: the time), not on the
+ *     number of processes.
+ * 2.  A batch is laid out as one vector:  pair j occupies elements
+ *     offsets[j], ..., offsets[j+1]-1 of x, y and z, and the whole
+ *     concatenation is block distributed and added by a single kernel
+ *     call per process.  MPI setup, the broadcast of the arguments,
+ *     the allocation check and the timing are paid once per batch
+ *     instead of once per pair.  Only the first and last pairs are
+ *     printed, followed by the batch's throughput.
+ * 3.  A service pays MPI_Init, MPI_Finalize and the allocation once;
+ *     the vectors are only reallocated when a job needs larger ones
+ *     (see Reserve_vectors).  Each job prints what a run of the
+ *     program would, "Took" line included, to its reply file.
  */
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <mpi.h>
 #include <time.h>
+#include <limits.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/stat.h>
+#include "vector_type.h"
+
+/* Number of elements printed from each end of a vector */
+#define PRINT_COUNT 10
+
+/* Weyl sequence increment used by SplitMix64 */
+#define GOLDEN_GAMMA 0x9E3779B97F4A7C15ULL
+
+/* Seed stream of the pair lengths (x and y are streams 0 and 1) */
+#define LENGTH_STREAM 2
+
+/* A batch of pairs laid out one after the other in x, y and z */
+typedef struct {
+   int         count;     /* number of pairs                         */
+   long long*  offsets;   /* pair j starts at offsets[j]; the last   */
+                          /* entry, offsets[count], is the total     */
+} Batch;
+
+/* One job:  what a run of the program computes */
+typedef struct {
+   long long           n;      /* order; with pairs, the largest pair */
+   unsigned long long  seed;   /* seed of x, y and the pair lengths   */
+   int                 pairs;  /* pairs in the batch, 0 for one pair  */
+   int                 stop;   /* 1: the service should stop          */
+} Job;
+
+/* Local blocks of x, y and z, kept from job to job by a service */
+typedef struct {
+   elem_t     *x, *y, *z;
+   long long  capacity;        /* elements each block can hold        */
+} Buffers;
+
+/* Longest job line read by a service, and most words in it */
+#define MAX_LINE 4096
+#define MAX_WORDS 8
+
+/* Phases timed on every process and summarized by Report_phases */
+#define PROGRAM "mpi_vector_add2"
+enum {ALLOC, INIT, COMPUTE, PRINT, PHASE_COUNT};
+char* phase_names[PHASE_COUNT] = {"alloc", "init", "compute", "print"};
 
 void Check_for_error(int local_ok, char fname[], char message[],
       MPI_Comm comm);
-void Allocate_vectors(double** local_x_pp, double** local_y_pp,
-      double** local_z_pp, int local_n, MPI_Comm comm);
-void Initialize_vector(double local_a[], int local_n, int n, int my_rank, int vector_id);
-void Print_vector(double local_b[], int local_n, int n, char title[],
+void Allocate_vectors(elem_t** local_x_pp, elem_t** local_y_pp,
+      elem_t** local_z_pp, long long local_n, MPI_Comm comm);
+void Initialize_vector(elem_t local_a[], long long local_n, long long n,
+      unsigned long long seed, int vector_id, int my_rank, int comm_sz);
+unsigned long long Mix64(unsigned long long z);
+void Print_vector(elem_t local_b[], long long n, char title[],
+      int my_rank, MPI_Comm comm);
+void Print_range(elem_t local_b[], long long n, long long first,
+      long long len, char title[], int my_rank, MPI_Comm comm);
+void Print_batch(elem_t local_x[], elem_t local_y[], elem_t local_z[],
+      Batch* batch_p, int my_rank, MPI_Comm comm);
+void Gather_slice(elem_t local_b[], long long n, long long first, long long count,
+      elem_t slice[], int tag, int my_rank, MPI_Comm comm);
+void Parallel_vector_sum(elem_t local_x[], elem_t local_y[],
+      elem_t local_z[], long long local_n);
+long long Block_first(long long n, int comm_sz, int q);
+long long Block_size(long long n, int comm_sz, int q);
+int Block_owner(long long n, int comm_sz, long long i);
+double Lap_ms(double* start_p);
+void Report_phases(double phase_ms[], long long n, int threads,
       int my_rank, MPI_Comm comm);
-void Parallel_vector_sum(double local_x[], double local_y[],
-      double local_z[], int local_n);
-void Read_n(int* n_p, int* local_n_p, int my_rank, int comm_sz, MPI_Comm comm, int argc, char *argv[]);
+void Read_n(Job* job_p, int* serving_p, char** service_p, int my_rank,
+      MPI_Comm comm, int argc, char *argv[]);
+int Parse_job(int count, char* words[], Job* job_p);
+int Job_ok(Job* job_p);
+void Random_lengths(long long lens[], int count, long long max_n,
+      unsigned long long seed);
+void Batch_layout(Batch* batch_p, long long lens[], int count,
+      MPI_Comm comm);
+void Report_batch(Batch* batch_p, double compute_ms, int my_rank,
+      MPI_Comm comm);
+void Run_job(Job* job_p, Buffers* bufs_p, int my_rank, int comm_sz,
+      MPI_Comm comm);
+void Reserve_vectors(Buffers* bufs_p, long long n, int comm_sz,
+      MPI_Comm comm);
+void Serve(char path[], Buffers* bufs_p, int my_rank, int comm_sz,
+      MPI_Comm comm);
+void Next_job(char path[], FILE** requests_p, Job* job_p,
+      int* reply_fd_p);
 
 /*-------------------------------------------------------------------*/
 int main(int argc, char *argv[]) {
-   int n; 
-   int local_n;
    int comm_sz, my_rank;
-   double *local_x, *local_y, *local_z;
    MPI_Comm comm;
-   double tstart, tend;
+   Job job;
+   Buffers bufs = {NULL, NULL, NULL, 0};
+   int serving;
+   char* service;
 
    MPI_Init(&argc, &argv);
    comm = MPI_COMM_WORLD;
@@ -37,31 +142,16 @@ int main(int argc, char *argv[]) {
    MPI_Comm_rank(comm, &my_rank);
 
    // Leer el tamaño del vector desde los argumentos de línea de comandos
-   Read_n(&n, &local_n, my_rank, comm_sz, comm, argc, argv);
-
-   tstart = MPI_Wtime();
-   Allocate_vectors(&local_x, &local_y, &local_z, local_n, comm);
-
-   // Inicializa los vectores con valores aleatorios diferentes
-   Initialize_vector(local_x, local_n, n, my_rank, 0);
-   Initialize_vector(local_y, local_n, n, my_rank, 1);
-
-   Parallel_vector_sum(local_x, local_y, local_z, local_n);
-   tend = MPI_Wtime();
-
-   // Imprimir primeros y últimos 10 elementos
-   Print_vector(local_x, local_n, n, "\nVector x", my_rank, comm);
-   Print_vector(local_y, local_n, n, "\nVector y", my_rank, comm);
-   Print_vector(local_z, local_n, n, "\nThe sum is", my_rank, comm);
+   Read_n(&job, &serving, &service, my_rank, comm, argc, argv);
 
-   double cpu_time_used = ((double) (tend - tstart)) * 1000;
-
-   if(my_rank == 0)
-       printf("\nTook %f ms to run\n", cpu_time_used);
+   if (serving)
+      Serve(service, &bufs, my_rank, comm_sz, comm);
+   else
+      Run_job(&job, &bufs, my_rank, comm_sz, comm);
 
-   free(local_x);
-   free(local_y);
-   free(local_z);
+   free(bufs.x);
+   free(bufs.y);
+   free(bufs.z);
 
    MPI_Finalize();
 
@@ -107,49 +197,460 @@ void Check_for_error(
 }  /* Check_for_error */
 
 
+/*-------------------------------------------------------------------
+ * Function:  Block_first
+ * Purpose:   Find the global index of the first element assigned to
+ *            process q by the balanced block distribution
+ * In args:   n:        order of global vector
+ *            comm_sz:  number of processes
+ *            q:        rank of the process
+ *
+ * Note:
+ *    The first n % comm_sz processes get n/comm_sz + 1 elements and
+ *    the others get n/comm_sz, so n need not be divisible by comm_sz.
+ */
+long long Block_first(
+      long long  n        /* in */,
+      int        comm_sz  /* in */,
+      int        q        /* in */) {
+   long long quotient = n/comm_sz, remainder = n % comm_sz;
+
+   return q*quotient + (q < remainder ? q : remainder);
+}  /* Block_first */
+
+
+/*-------------------------------------------------------------------
+ * Function:  Block_size
+ * Purpose:   Find the number of elements assigned to process q by the
+ *            balanced block distribution
+ * In args:   n:        order of global vector
+ *            comm_sz:  number of processes
+ *            q:        rank of the process
+ */
+long long Block_size(
+      long long  n        /* in */,
+      int        comm_sz  /* in */,
+      int        q        /* in */) {
+   return n/comm_sz + (q < n % comm_sz ? 1 : 0);
+}  /* Block_size */
+
+
+/*-------------------------------------------------------------------
+ * Function:  Block_owner
+ * Purpose:   Find the process that owns global element i under the
+ *            balanced block distribution
+ * In args:   n:        order of global vector
+ *            comm_sz:  number of processes
+ *            i:        global index, 0 <= i < n
+ */
+int Block_owner(
+      long long  n        /* in */,
+      int        comm_sz  /* in */,
+      long long  i        /* in */) {
+   long long quotient = n/comm_sz, remainder = n % comm_sz;
+   long long split = remainder*(quotient + 1);
+
+   if (i < split) return i/(quotient + 1);
+   return remainder + (i - split)/quotient;
+}  /* Block_owner */
+
+
 /*-------------------------------------------------------------------
  * Function:  Read_n
- * Purpose:   Get the order of the vectors from command line arguments
- *            on proc 0 and broadcast to other processes.
+ * Purpose:   Get the job (the order of the vectors, the seed and the
+ *            batch) or the service's FIFO from command line arguments
+ *            on proc 0 and broadcast them to other processes.
  * In args:   my_rank:    process rank in communicator
- *            comm_sz:    number of processes in communicator
  *            comm:       communicator containing all the processes
  *                        calling Read_n
- * Out args:  n_p:        global value of n
- *            local_n_p:  local value of n = n/comm_sz
+ * Out args:  job_p:      the job (see Parse_job)
+ *            serving_p:  1 with -S <fifo>, 0 otherwise
+ *            service_p:  on process 0, the FIFO named by -S
  *
- * Errors:    n should be positive and evenly divisible by comm_sz
+ * Errors:    n should be positive, and so should the number of pairs
+ *            with -k
  */
 void Read_n(
-      int*      n_p        /* out */,
-      int*      local_n_p  /* out */,
-      int       my_rank    /* in  */,
-      int       comm_sz    /* in  */,
-      MPI_Comm  comm       /* in  */,
-      int       argc,
-      char*     argv[]) {
+      Job*       job_p      /* out */,
+      int*       serving_p  /* out */,
+      char**     service_p  /* out */,
+      int        my_rank    /* in  */,
+      MPI_Comm   comm       /* in  */,
+      int        argc,
+      char*      argv[]) {
    int local_ok = 1;
    char *fname = "Read_n";
 
    if (my_rank == 0) {
-      if (argc < 2) {
-         fprintf(stderr, "Usage: %s <number_of_elements>\n", argv[0]);
+      *serving_p = argc == 3 && strcmp(argv[1], "-S") == 0;
+      *service_p = *serving_p ? argv[2] : NULL;
+      if (*serving_p) {
+         job_p->n = 1;
+         job_p->pairs = 0;
+      } else if (!Parse_job(argc - 1, argv + 1, job_p)) {
+         fprintf(stderr, "Usage: %s [-k pairs] <number_of_elements> [seed]\n"
+               "       %s -S <fifo>\n", argv[0], argv[0]);
          MPI_Abort(comm, 1);
       }
-      *n_p = atoi(argv[1]);
-      printf("Proc 0 read n = %d\n", *n_p);
    }
 
-   // Comunicar el tamaño a todos los procesos
-   MPI_Bcast(n_p, 1, MPI_INT, 0, comm);
+   // Comunicar el trabajo (tamaño, semilla, pares) a todos los procesos
+   MPI_Bcast(serving_p, 1, MPI_INT, 0, comm);
+   MPI_Bcast(job_p, sizeof(Job), MPI_BYTE, 0, comm);
 
-   if (*n_p <= 0 || *n_p % comm_sz != 0) local_ok = 0;
+   if (!Job_ok(job_p)) local_ok = 0;
    Check_for_error(local_ok, fname,
-         "n should be > 0 and evenly divisible by comm_sz", comm);
-   *local_n_p = *n_p / comm_sz;
+         "n and the number of pairs should be > 0", comm);
 }  /* Read_n */
 
 
+/*-------------------------------------------------------------------
+ * Function:  Parse_job
+ * Purpose:   Read a job from its arguments:
+ *               [-k pairs] <number_of_elements> [seed]
+ * In args:   count:  number of arguments
+ *            words:  the arguments
+ * Out arg:   job_p:  the job; the seed defaults to the current time,
+ *                    and -k with a count that isn't positive gives
+ *                    pairs = -1 (rejected by Job_ok)
+ * Ret val:   1 if the arguments have the right form, 0 otherwise
+ *
+ * Note:
+ *    Used for the command line and for the lines sent to a service,
+ *    so both take the same arguments.
+ */
+int Parse_job(
+      int     count    /* in  */,
+      char*   words[]  /* in  */,
+      Job*    job_p    /* out */) {
+   int i = 0;
+
+   job_p->pairs = 0;
+   job_p->stop = 0;
+   if (count >= 2 && strcmp(words[0], "-k") == 0) {
+      job_p->pairs = atoi(words[1]) > 0 ? atoi(words[1]) : -1;
+      i = 2;
+   }
+   if (count - i < 1 || count - i > 2 || words[i][0] == '-') return 0;
+   job_p->n = strtoll(words[i], NULL, 10);
+   job_p->seed = count - i > 1 ? strtoull(words[i+1], NULL, 10)
+      : (unsigned long long) time(NULL);
+   return 1;
+}  /* Parse_job */
+
+
+/*-------------------------------------------------------------------
+ * Function:  Job_ok
+ * Purpose:   Check the values of a job:  n > 0 and pairs >= 0
+ */
+int Job_ok(Job* job_p /* in */) {
+   return job_p->n > 0 && job_p->pairs >= 0;
+}  /* Job_ok */
+
+
+/*-------------------------------------------------------------------
+ * Function:  Random_lengths
+ * Purpose:   Draw the lengths of the pairs of a batch from the seed
+ * In args:   count:  number of pairs
+ *            max_n:  largest length
+ *            seed:   same seed as Initialize_vector
+ * Out arg:   lens:   count lengths between 1 and max_n
+ *
+ * Note:
+ *    The lengths are a counter-based function of (seed, j), like the
+ *    elements, so every process computes the same ones without any
+ *    communication.
+ */
+void Random_lengths(
+      long long           lens[]  /* out */,
+      int                 count   /* in  */,
+      long long           max_n   /* in  */,
+      unsigned long long  seed    /* in  */) {
+   unsigned long long key = Mix64(seed + GOLDEN_GAMMA*(LENGTH_STREAM + 1));
+   int j;
+
+   for (j = 0; j < count; j++)
+      lens[j] = 1 + (long long) (Mix64(key
+               + GOLDEN_GAMMA*(unsigned long long) j) % max_n);
+}  /* Random_lengths */
+
+
+/*-------------------------------------------------------------------
+ * Function:  Batch_layout
+ * Purpose:   Lay out count pairs of the given lengths one after the
+ *            other in a single vector
+ * In args:   lens:     the length of each pair (NULL if it couldn't be
+ *                      allocated)
+ *            count:    number of pairs
+ *            comm:     communicator containing all the processes
+ * Out arg:   batch_p:  the batch; free batch_p->offsets when done
+ *
+ * Errors:    The offsets can't be allocated, or a length isn't
+ *            positive, or the total doesn't fit in a long long
+ */
+void Batch_layout(
+      Batch*     batch_p  /* out */,
+      long long  lens[]   /* in  */,
+      int        count    /* in  */,
+      MPI_Comm   comm     /* in  */) {
+   int local_ok = 1, j;
+   char* fname = "Batch_layout";
+   long long* offsets = malloc(((size_t) count + 1)*sizeof(long long));
+
+   if (lens == NULL || offsets == NULL) {
+      local_ok = 0;
+   } else {
+      offsets[0] = 0;
+      for (j = 0; j < count && local_ok; j++)
+         if (lens[j] <= 0 || lens[j] > LLONG_MAX - offsets[j])
+            local_ok = 0;
+         else
+            offsets[j+1] = offsets[j] + lens[j];
+   }
+   Check_for_error(local_ok, fname,
+         "Can't lay out the batch (no memory or a bad length)", comm);
+   batch_p->count = count;
+   batch_p->offsets = offsets;
+}  /* Batch_layout */
+
+
+/*-------------------------------------------------------------------
+ * Function:  Run_job
+ * Purpose:   Generate x and y, add them and print and time the result:
+ *            everything a run of the program does between MPI_Init
+ *            and MPI_Finalize
+ * In args:   job_p:    the job
+ *            my_rank:  rank of calling process
+ *            comm_sz:  number of processes
+ *            comm:     communicator containing all the processes
+ * In/out arg:  bufs_p:  local blocks, grown if the job needs more
+ */
+void Run_job(
+      Job*       job_p    /* in     */,
+      Buffers*   bufs_p   /* in/out */,
+      int        my_rank  /* in     */,
+      int        comm_sz  /* in     */,
+      MPI_Comm   comm     /* in     */) {
+   long long n = job_p->n, local_n;
+   double tstart, tend, lap;
+   double phase_ms[PHASE_COUNT];
+   long long* lens;
+   Batch batch = {0, NULL};
+
+   if (my_rank == 0) {
+      printf("Proc 0 read n = %lld, seed = %llu\n", n, job_p->seed);
+      if (job_p->pairs > 0)
+         printf("Batch of %d pairs of at most %lld elements\n",
+               job_p->pairs, n);
+   }
+
+   tstart = lap = MPI_Wtime();
+   if (job_p->pairs > 0) {
+      // Todos los procesos generan las mismas longitudes, sin mensajes
+      lens = malloc(job_p->pairs*sizeof(long long));
+      if (lens != NULL) Random_lengths(lens, job_p->pairs, n, job_p->seed);
+      Batch_layout(&batch, lens, job_p->pairs, comm);
+      free(lens);
+      n = batch.offsets[job_p->pairs];
+   }
+   local_n = Block_size(n, comm_sz, my_rank);
+   Reserve_vectors(bufs_p, n, comm_sz, comm);
+   phase_ms[ALLOC] = Lap_ms(&lap);
+
+   // Inicializa los vectores con valores aleatorios diferentes
+   Initialize_vector(bufs_p->x, local_n, n, job_p->seed, 0, my_rank,
+         comm_sz);
+   Initialize_vector(bufs_p->y, local_n, n, job_p->seed, 1, my_rank,
+         comm_sz);
+   phase_ms[INIT] = Lap_ms(&lap);
+
+   Parallel_vector_sum(bufs_p->x, bufs_p->y, bufs_p->z, local_n);
+   phase_ms[COMPUTE] = Lap_ms(&lap);
+   tend = MPI_Wtime();
+
+   // Imprimir primeros y últimos 10 elementos
+   if (job_p->pairs > 0) {
+      Print_batch(bufs_p->x, bufs_p->y, bufs_p->z, &batch, my_rank, comm);
+   } else {
+      Print_vector(bufs_p->x, n, "\nVector x", my_rank, comm);
+      Print_vector(bufs_p->y, n, "\nVector y", my_rank, comm);
+      Print_vector(bufs_p->z, n, "\nThe sum is", my_rank, comm);
+   }
+   phase_ms[PRINT] = Lap_ms(&lap);
+
+   double cpu_time_used = ((double) (tend - tstart)) * 1000;
+
+   if(my_rank == 0)
+       printf("\nTook %f ms to run\n", cpu_time_used);
+   Report_phases(phase_ms, n, 1, my_rank, comm);
+   if (job_p->pairs > 0)
+      Report_batch(&batch, phase_ms[COMPUTE], my_rank, comm);
+
+   free(batch.offsets);
+}  /* Run_job */
+
+
+/*-------------------------------------------------------------------
+ * Function:  Reserve_vectors
+ * Purpose:   Make sure the local blocks can hold a job with n
+ *            elements, reallocating them only if they're too small
+ * In args:   n:        order of global vector
+ *            comm_sz:  number of processes
+ *            comm:     communicator containing all the processes
+ * In/out arg:  bufs_p:  the local blocks
+ *
+ * Note:
+ *    Every process sizes its blocks for the largest block (process
+ *    0's), so they all agree on whether to reallocate and all call
+ *    the collective Check_for_error in Allocate_vectors, or none do.
+ */
+void Reserve_vectors(
+      Buffers*   bufs_p   /* in/out */,
+      long long  n        /* in     */,
+      int        comm_sz  /* in     */,
+      MPI_Comm   comm     /* in     */) {
+   long long need = Block_size(n, comm_sz, 0);
+
+   if (need <= bufs_p->capacity) return;
+   free(bufs_p->x);
+   free(bufs_p->y);
+   free(bufs_p->z);
+   Allocate_vectors(&bufs_p->x, &bufs_p->y, &bufs_p->z, need, comm);
+   bufs_p->capacity = need;
+}  /* Reserve_vectors */
+
+
+/*-------------------------------------------------------------------
+ * Function:  Serve
+ * Purpose:   Run the jobs written to a FIFO, one after another, with
+ *            the same processes and buffers
+ * In args:   path:     on process 0, the FIFO (created if it doesn't
+ *                      exist, and then removed at the end)
+ *            my_rank:  rank of calling process
+ *            comm_sz:  number of processes
+ *            comm:     communicator containing all the processes
+ * In/out arg:  bufs_p:  local blocks, reused from job to job
+ *
+ * Note:
+ *    Each job is one line (see Next_job).  Process 0 broadcasts the
+ *    job's descriptor, the only communication between jobs, and
+ *    sends what the job prints on stdout to the job's reply file.
+ *    A line "quit" stops the service.
+ */
+void Serve(
+      char       path[]   /* in     */,
+      Buffers*   bufs_p   /* in/out */,
+      int        my_rank  /* in     */,
+      int        comm_sz  /* in     */,
+      MPI_Comm   comm     /* in     */) {
+   FILE* requests = NULL;
+   Job job;
+   int reply_fd = -1, saved_fd = -1, created = 0, jobs = 0;
+
+   if (my_rank == 0) {
+      if (mkfifo(path, 0600) == 0) {
+         created = 1;
+      } else if (errno != EEXIST) {
+         perror(path);
+         MPI_Abort(comm, 1);
+      }
+      // Un cliente que cierra la respuesta antes de tiempo no debe
+      // matar al servicio
+      signal(SIGPIPE, SIG_IGN);
+      printf("Serving jobs from %s with %d processes\n", path, comm_sz);
+      fflush(stdout);
+   }
+
+   for (;;) {
+      if (my_rank == 0) Next_job(path, &requests, &job, &reply_fd);
+      MPI_Bcast(&job, sizeof(Job), MPI_BYTE, 0, comm);
+      if (job.stop) break;
+
+      if (my_rank == 0) {
+         fflush(stdout);
+         saved_fd = dup(STDOUT_FILENO);
+         dup2(reply_fd, STDOUT_FILENO);
+         close(reply_fd);
+      }
+      Run_job(&job, bufs_p, my_rank, comm_sz, comm);
+      if (my_rank == 0) {
+         fflush(stdout);
+         dup2(saved_fd, STDOUT_FILENO);
+         close(saved_fd);
+      }
+      jobs++;
+   }
+
+   if (my_rank == 0) {
+      if (requests != NULL) fclose(requests);
+      if (created) unlink(path);
+      printf("Served %d jobs\n", jobs);
+   }
+}  /* Serve */
+
+
+/*-------------------------------------------------------------------
+ * Function:  Next_job
+ * Purpose:   Wait for the next valid job on the service's FIFO
+ * In arg:    path:        the FIFO
+ * In/out arg:  requests_p:  the FIFO opened for reading, or NULL;
+ *                           reopened when every writer has closed it
+ * Out args:  job_p:       the job, or one with stop = 1 for "quit"
+ *            reply_fd_p:  the job's reply file, open for writing
+ *
+ * Note:
+ *    A job is a line
+ *       <reply> [-k pairs] <number_of_elements> [seed]
+ *    where <reply> is a file or FIFO the job's output is written to
+ *    (a client can mkfifo it and read it after writing the line).
+ *    A bad line is answered with a message on <reply> and skipped.
+ */
+void Next_job(
+      char    path[]        /* in     */,
+      FILE**  requests_p    /* in/out */,
+      Job*    job_p         /* out    */,
+      int*    reply_fd_p    /* out    */) {
+   char line[MAX_LINE];
+   char* words[MAX_WORDS];
+   char* w;
+   int count;
+
+   for (;;) {
+      if (*requests_p == NULL && (*requests_p = fopen(path, "r")) == NULL) {
+         perror(path);
+         job_p->stop = 1;
+         return;
+      }
+      if (fgets(line, sizeof(line), *requests_p) == NULL) {
+         fclose(*requests_p);
+         *requests_p = NULL;
+         continue;
+      }
+
+      count = 0;
+      for (w = strtok(line, " \t\r\n"); w != NULL && count < MAX_WORDS;
+            w = strtok(NULL, " \t\r\n"))
+         words[count++] = w;
+      if (count == 0) continue;
+      if (strcmp(words[0], "quit") == 0) {
+         job_p->stop = 1;
+         return;
+      }
+
+      *reply_fd_p = open(words[0], O_WRONLY | O_CREAT | O_TRUNC, 0644);
+      if (*reply_fd_p < 0) {
+         perror(words[0]);
+         continue;
+      }
+      if (Parse_job(count - 1, words + 1, job_p) && Job_ok(job_p))
+         return;
+      dprintf(*reply_fd_p, "Bad job:  use <reply> [-k pairs] "
+            "<number_of_elements> [seed], with n and pairs > 0\n");
+      close(*reply_fd_p);
+   }
+}  /* Next_job */
+
+
 /*-------------------------------------------------------------------
  * Function:  Allocate_vectors
  * Purpose:   Allocate storage for x, y, and z
@@ -161,20 +662,20 @@ void Read_n(
  * Errors:    One or more of the calls to malloc fails
  */
 void Allocate_vectors(
-      double**   local_x_pp  /* out */,
-      double**   local_y_pp  /* out */,
-      double**   local_z_pp  /* out */,
-      int        local_n     /* in  */,
+      elem_t**   local_x_pp  /* out */,
+      elem_t**   local_y_pp  /* out */,
+      elem_t**   local_z_pp  /* out */,
+      long long  local_n     /* in  */,
       MPI_Comm   comm        /* in  */) {
    int local_ok = 1;
    char* fname = "Allocate_vectors";
 
-   *local_x_pp = malloc(local_n*sizeof(double));
-   *local_y_pp = malloc(local_n*sizeof(double));
-   *local_z_pp = malloc(local_n*sizeof(double));
+   *local_x_pp = malloc((size_t) local_n*sizeof(elem_t));
+   *local_y_pp = malloc((size_t) local_n*sizeof(elem_t));
+   *local_z_pp = malloc((size_t) local_n*sizeof(elem_t));
 
-   if (*local_x_pp == NULL || *local_y_pp == NULL ||
-       *local_z_pp == NULL) local_ok = 0;
+   if (local_n > 0 && (*local_x_pp == NULL || *local_y_pp == NULL ||
+       *local_z_pp == NULL)) local_ok = 0;
    Check_for_error(local_ok, fname, "Can't allocate local vector(s)",
          comm);
 }  /* Allocate_vectors */
@@ -182,74 +683,218 @@ void Allocate_vectors(
 
 /*-------------------------------------------------------------------
  * Function:   Initialize_vector
- * Purpose:    Inicializa un vector con valores aleatorios
+ * Purpose:    Inicializa un vector con valores aleatorios entre 0 y 99
+ * In args:    local_n:    size of local vector
+ *             n:          size of global vector
+ *             seed:       seed shared by all processes
+ *             vector_id:  0 for x, 1 for y
+ *             my_rank:    rank of calling process
+ *             comm_sz:    number of processes
+ * Out arg:    local_a:    this process' block of the vector
+ *
+ * Note:
+ *    Element i is a counter-based function of (seed, vector_id, i), the
+ *    global index, so the vector is the same for every comm_sz and
+ *    different vectors never share a stream.
  */
 void Initialize_vector(
-      double local_a[]   /* out */,
-      int    local_n     /* in  */,
-      int    n           /* in  */,
-      int    my_rank     /* in  */,
-      int    vector_id   /* in  */) {
-
-   srand(time(NULL) + my_rank + vector_id);  // Seed único por proceso
-   for (int i = 0; i < local_n; i++) {
-      local_a[i] = rand() % 100; // Genera valores aleatorios entre 0 y 99
+      elem_t              local_a[]   /* out */,
+      long long           local_n     /* in  */,
+      long long           n           /* in  */,
+      unsigned long long  seed        /* in  */,
+      int                 vector_id   /* in  */,
+      int                 my_rank     /* in  */,
+      int                 comm_sz     /* in  */) {
+   long long first = Block_first(n, comm_sz, my_rank);
+   unsigned long long key = Mix64(seed + GOLDEN_GAMMA*(vector_id + 1));
+   unsigned long long r;
+   long long i;
+
+   for (i = 0; i < local_n; i++) {
+      r = Mix64(key + GOLDEN_GAMMA*(unsigned long long) (first + i));
+      local_a[i] = (elem_t) (((r >> 11) * 100) >> 53);
    }
-}
+}  /* Initialize_vector */
+
+
+/*-------------------------------------------------------------------
+ * Function:  Mix64
+ * Purpose:   SplitMix64 finalizer:  scramble the bits of a 64-bit word
+ */
+unsigned long long Mix64(unsigned long long z /* in */) {
+   z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+   z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+   return z ^ (z >> 31);
+}  /* Mix64 */
 
 
 /*-------------------------------------------------------------------
  * Function:  Print_vector
- * Purpose:   Print a vector that has a block distribution to stdout
+ * Purpose:   Print the first and last PRINT_COUNT elements of a vector
+ *            that has a block distribution
  * In args:   local_b:  local storage for vector to be printed
- *            local_n:  order of local vectors
- *            n:        order of global vector (local_n*comm_sz)
+ *            n:        order of global vector
  *            title:    title to precede print out
+ *            my_rank:  rank of calling process
  *            comm:     communicator containing processes calling
  *                      Print_vector
  *
- * Error:     if process 0 can't allocate temporary storage for
- *            the full vector, the program terminates.
- *
  * Note:
- *    Assumes order of vector is evenly divisible by the number of
- *    processes
+ *    Only the ranks owning the head or the tail of the vector send
+ *    anything, so process 0 never needs more than 2*PRINT_COUNT
+ *    elements of temporary storage.
  */
 void Print_vector(
-      double    local_b[]  /* in */,
-      int       local_n    /* in */,
-      int       n          /* in */,
+      elem_t    local_b[]  /* in */,
+      long long n          /* in */,
       char      title[]    /* in */,
       int       my_rank    /* in */,
       MPI_Comm  comm       /* in */) {
 
-   double* b = NULL;
+   Print_range(local_b, n, 0, n, title, my_rank, comm);
+}  /* Print_vector */
+
+
+/*-------------------------------------------------------------------
+ * Function:  Print_range
+ * Purpose:   Print the first and last PRINT_COUNT of the global
+ *            elements first, ..., first+len-1 of a vector that has a
+ *            block distribution
+ * In args:   local_b:  local storage for vector to be printed
+ *            n:        order of global vector
+ *            first:    global index of the range's first element
+ *            len:      number of elements in the range
+ *            title:    title to precede print out
+ *            my_rank:  rank of calling process
+ *            comm:     communicator containing processes calling
+ *                      Print_range
+ */
+void Print_range(
+      elem_t    local_b[]  /* in */,
+      long long n          /* in */,
+      long long first      /* in */,
+      long long len        /* in */,
+      char      title[]    /* in */,
+      int       my_rank    /* in */,
+      MPI_Comm  comm       /* in */) {
+   elem_t head[PRINT_COUNT], tail[PRINT_COUNT];
+   int count = len < PRINT_COUNT ? (int) len : PRINT_COUNT;
    int i;
-   int local_ok = 1;
-   char* fname = "Print_vector";
+
+   Gather_slice(local_b, n, first, count, head, 0, my_rank, comm);
+   Gather_slice(local_b, n, first + len - count, count, tail, 1, my_rank,
+         comm);
 
    if (my_rank == 0) {
-      b = malloc(n*sizeof(double));
-      MPI_Gather(local_b, local_n, MPI_DOUBLE, b, local_n, MPI_DOUBLE, 0, comm);
       printf("%s:\n", title);
 
       // Imprimir primeros 10 elementos
-      printf("First 10 elements: ");
-      for (i = 0; i < 10 && i < n; i++)
-         printf("%f ", b[i]);
+      printf("First %d elements: ", count);
+      for (i = 0; i < count; i++)
+         printf(ELEM_FMT " ", head[i]);
       printf("\n");
 
       // Imprimir últimos 10 elementos
-      printf("Last 10 elements: ");
-      for (i = n-10; i < n; i++)
-         printf("%f ", b[i]);
+      printf("Last %d elements: ", count);
+      for (i = 0; i < count; i++)
+         printf(ELEM_FMT " ", tail[i]);
       printf("\n");
+   }
+}  /* Print_range */
+
+
+/*-------------------------------------------------------------------
+ * Function:  Print_batch
+ * Purpose:   Print x, y and z of the first and the last pair of a
+ *            batch
+ * In args:   local_x, local_y, local_z:  local blocks of the batch
+ *            batch_p:  the layout of the batch
+ *            my_rank:  rank of calling process
+ *            comm:     communicator containing processes calling
+ *                      Print_batch
+ */
+void Print_batch(
+      elem_t    local_x[]  /* in */,
+      elem_t    local_y[]  /* in */,
+      elem_t    local_z[]  /* in */,
+      Batch*    batch_p    /* in */,
+      int       my_rank    /* in */,
+      MPI_Comm  comm       /* in */) {
+   long long n = batch_p->offsets[batch_p->count], first, len;
+   char title[64];
+   int j;
+
+   for (j = 0; j < batch_p->count; j += batch_p->count - 1) {
+      first = batch_p->offsets[j];
+      len = batch_p->offsets[j+1] - first;
+      snprintf(title, sizeof(title), "\nPair %d, vector x (%lld elements)",
+            j, len);
+      Print_range(local_x, n, first, len, title, my_rank, comm);
+      snprintf(title, sizeof(title), "\nPair %d, vector y", j);
+      Print_range(local_y, n, first, len, title, my_rank, comm);
+      snprintf(title, sizeof(title), "\nPair %d, the sum is", j);
+      Print_range(local_z, n, first, len, title, my_rank, comm);
+      if (batch_p->count == 1) break;
+   }
+}  /* Print_batch */
+
+
+/*-------------------------------------------------------------------
+ * Function:  Gather_slice
+ * Purpose:   Collect the global elements first, ..., first+count-1 of
+ *            a block distributed vector on process 0 using
+ *            point-to-point messages from the processes that own them
+ * In args:   local_b:  local storage for the distributed vector
+ *            n:        order of global vector
+ *            first:    global index of the first element wanted
+ *            count:    number of elements wanted
+ *            tag:      message tag used for this slice
+ *            my_rank:  rank of calling process
+ *            comm:     communicator containing processes calling
+ *                      Gather_slice
+ * Out arg:   slice:    on process 0, the count requested elements
+ */
+void Gather_slice(
+      elem_t    local_b[]  /* in  */,
+      long long n          /* in  */,
+      long long first      /* in  */,
+      long long count      /* in  */,
+      elem_t    slice[]    /* out */,
+      int       tag        /* in  */,
+      int       my_rank    /* in  */,
+      MPI_Comm  comm       /* in  */) {
+   int comm_sz, q;
+   long long q_first, lo, hi;
+   long long last = first + count;
+
+   if (count <= 0) return;
+   MPI_Comm_size(comm, &comm_sz);
 
-      free(b);
+   if (my_rank == 0) {
+      for (q = Block_owner(n, comm_sz, first);
+            q < comm_sz && Block_first(n, comm_sz, q) < last; q++) {
+         q_first = Block_first(n, comm_sz, q);
+         lo = q_first > first ? q_first : first;
+         hi = q_first + Block_size(n, comm_sz, q);
+         if (hi > last) hi = last;
+         if (lo >= hi) continue;
+         if (q == 0)
+            memcpy(slice + (lo - first), local_b + lo,
+                  (hi - lo)*sizeof(elem_t));
+         else
+            MPI_Recv(slice + (lo - first), (int) (hi - lo), MPI_ELEM,
+                  q, tag, comm, MPI_STATUS_IGNORE);
+      }
    } else {
-      MPI_Gather(local_b, local_n, MPI_DOUBLE, b, local_n, MPI_DOUBLE, 0, comm);
+      q_first = Block_first(n, comm_sz, my_rank);
+      lo = q_first > first ? q_first : first;
+      hi = q_first + Block_size(n, comm_sz, my_rank);
+      if (hi > last) hi = last;
+      if (lo < hi)
+         MPI_Send(local_b + (lo - q_first), (int) (hi - lo), MPI_ELEM,
+               0, tag, comm);
    }
-}  /* Print_vector */
+}  /* Gather_slice */
 
 
 /*-------------------------------------------------------------------
@@ -262,12 +907,95 @@ void Print_vector(
  * Out arg:   local_z:  local storage for the sum of the two vectors
  */
 void Parallel_vector_sum(
-      double  local_x[]  /* in  */,
-      double  local_y[]  /* in  */,
-      double  local_z[]  /* out */,
-      int     local_n    /* in  */) {
-   int local_i;
+      elem_t     local_x[]  /* in  */,
+      elem_t     local_y[]  /* in  */,
+      elem_t     local_z[]  /* out */,
+      long long  local_n    /* in  */) {
+   long long local_i;
 
    for (local_i = 0; local_i < local_n; local_i++)
       local_z[local_i] = local_x[local_i] + local_y[local_i];
 }  /* Parallel_vector_sum */
+
+
+/*-------------------------------------------------------------------
+ * Function:  Lap_ms
+ * Purpose:   Return the milliseconds elapsed since *start_p and restart
+ *            the lap at the current time
+ * In/out arg:  start_p:  MPI_Wtime() at the start of the lap
+ */
+double Lap_ms(double* start_p /* in/out */) {
+   double now = MPI_Wtime();
+   double ms = (now - *start_p)*1000;
+
+   *start_p = now;
+   return ms;
+}  /* Lap_ms */
+
+
+/*-------------------------------------------------------------------
+ * Function:  Report_phases
+ * Purpose:   Reduce every process' phase times to their minimum,
+ *            average and maximum and print them on process 0 as one
+ *            JSON line starting with "TIMING "
+ * In args:   phase_ms:  this process' time in each phase (ms)
+ *            n:         order of global vector
+ *            threads:   threads per process
+ *            my_rank:   rank of calling process
+ *            comm:      communicator containing all processes
+ */
+void Report_phases(
+      double     phase_ms[]  /* in */,
+      long long  n           /* in */,
+      int        threads     /* in */,
+      int        my_rank     /* in */,
+      MPI_Comm   comm        /* in */) {
+   double min[PHASE_COUNT], max[PHASE_COUNT], sum[PHASE_COUNT];
+   int comm_sz, p;
+
+   MPI_Comm_size(comm, &comm_sz);
+   MPI_Reduce(phase_ms, min, PHASE_COUNT, MPI_DOUBLE, MPI_MIN, 0, comm);
+   MPI_Reduce(phase_ms, max, PHASE_COUNT, MPI_DOUBLE, MPI_MAX, 0, comm);
+   MPI_Reduce(phase_ms, sum, PHASE_COUNT, MPI_DOUBLE, MPI_SUM, 0, comm);
+
+   if (my_rank == 0) {
+      printf("TIMING {\"program\":\"%s\",\"comm_sz\":%d,\"threads\":%d,"
+            "\"n\":%lld,\"unit\":\"ms\",\"phases\":{", PROGRAM, comm_sz,
+            threads, n);
+      for (p = 0; p < PHASE_COUNT; p++)
+         printf("%s\"%s\":{\"min\":%.3f,\"avg\":%.3f,\"max\":%.3f}",
+               p > 0 ? "," : "", phase_names[p], min[p],
+               sum[p]/comm_sz, max[p]);
+      printf("}}\n");
+   }
+}  /* Report_phases */
+
+
+/*-------------------------------------------------------------------
+ * Function:  Report_batch
+ * Purpose:   Print the throughput of the batch's addition on process 0
+ * In args:   batch_p:     the layout of the batch
+ *            compute_ms:  this process' time in the sum kernel (ms)
+ *            my_rank:     rank of calling process
+ *            comm:        communicator containing all processes
+ *
+ * Note:
+ *    The batch is done when the slowest process is, so the rates use
+ *    the largest compute time.  Each element moves 3 elem_ts (x and
+ *    y read, z written).
+ */
+void Report_batch(
+      Batch*     batch_p     /* in */,
+      double     compute_ms  /* in */,
+      int        my_rank     /* in */,
+      MPI_Comm   comm        /* in */) {
+   long long n = batch_p->offsets[batch_p->count];
+   double max_ms;
+
+   MPI_Reduce(&compute_ms, &max_ms, 1, MPI_DOUBLE, MPI_MAX, 0, comm);
+   if (my_rank == 0 && max_ms > 0)
+      printf("Batch of %d pairs, %lld elements added in %.3f ms: "
+            "%.0f pairs/s, %.3f GB/s\n", batch_p->count, n, max_ms,
+            batch_p->count/max_ms*1000,
+            3.0*n*sizeof(elem_t)/max_ms/1e6);
+}  /* Report_batch */
@@ -1,89 +1,411 @@
 /* File:     mpi_vector_add3.c
  *
- * Compile:  mpicc -g -Wall -o mpi_vector_add3 mpi_vector_add3.c
- * Run:      mpiexec ./mpi_vector_add3 <number_of_elements> <scalar>
- * 
+ * Compile:  mpicc -g -Wall -O2 -fopenmp -o mpi_vector_add3 mpi_vector_add3.c -lm
+ *           (-DVEC_FLOAT or -DVEC_MIXED for float vectors, see
+ *           vector_type.h)
+ * Run:      mpiexec ./mpi_vector_add3 [-a] [-e program] [-f] [-i] [-p] [-r]
+ *              [-s seed] [-t tile] <number_of_elements> <scalar> [threads]
+ *
+ * Options:  -a  reduce the dot product onto every process
+ *               (MPI_Iallreduce) instead of only process 0
+ *           -e <program>  instead of the sum, dot product and scaling,
+ *               run the elementwise statements of program over x, y and
+ *               the scalar a in one fused pass (see vector_expr.h), e.g.
+ *                  -e "z = a*x + y; w = x*x - y; s = sum(z*w); n = norm(z)"
+ *               -e "z = x + y; sx = a*x; sy = a*y; dot = sum(x*y)" does
+ *               what -f does
+ *           -f  compute z, the dot product and both scaled vectors in a
+ *               single fused pass instead of four separate passes
+ *           -i  write the scaled vectors over x and y instead of
+ *               allocating scaled_x and scaled_y
+ *           -p  print the CPU and NUMA node of every thread and where
+ *               the pages of x ended up
+ *           -r  reproducible dot product:  the products summed
+ *               exactly, so bitwise the same for any number of
+ *               processes and threads
+ *           -s <seed>  seed for x and y (default: the time); the
+ *               vectors don't depend on the number of processes
+ *           -t <tile>  run the sum, dot product and scaling kernels on
+ *               one tile of <tile> elements before the next; -t auto
+ *               (or 0) sizes the tiles from the L2 (see Tile_size)
+ *
+ * Notes:
+ * 1.  Each process runs the vector kernels with a team of threads
+ *     (default: OMP_NUM_THREADS), so a few processes per node can be
+ *     compared against one process per core.  Without -fopenmp the
+ *     kernels are single-threaded and the threads argument is ignored.
+ * 2.  Each thread runs the SIMD kernels from vector_kernels.h on its
+ *     part of the local block (see VECTOR_KERNELS there).
+ * 3.  With -i the original x and y are overwritten, so only the scaled
+ *     vectors are printed.
+ * 4.  The threads of the processes on a node are pinned to distinct
+ *     CPUs following VECTOR_PIN (see placement.h).  Every page of the
+ *     vectors is first touched by the thread that later processes it,
+ *     with the same Thread_block split as the kernels, so on NUMA
+ *     machines each thread works on memory on its own node.
+ * 5.  The dot product reduction is started with MPI_Ireduce (or
+ *     MPI_Iallreduce) as soon as the local partial is ready and only
+ *     waited for after the scaling passes, so its latency is hidden
+ *     behind them; the reduce phase is the time left waiting.
+ * 6.  All the vectors of a process are 64-byte aligned pieces of one
+ *     arena backed by huge pages where available (see arena.h and
+ *     VECTOR_PAGES there).
+ * 7.  With -r each thread sums the products x[i]*y[i] exactly into
+ *     an Exact_sum (see exact_sum.h), the threads' sums are merged
+ *     and the processes' sums are combined by MPI_Ireduce with a
+ *     user-defined op; the result is rounded to a double only at the
+ *     end.  Integer addition is associative, so neither the block
+ *     distribution nor the reduction tree can change a bit of it.
+ *     The dot phase in the timing line is the local dot product, so
+ *     runs with and without -r give the cost of reproducibility.
+ *     With -f the exact products are summed in the fused pass, a tile
+ *     at a time (see Fused_vector_ops), so they count as compute.
+ * 8.  The vectors are doubles unless compiled with -DVEC_FLOAT (float
+ *     vectors and dot product) or -DVEC_MIXED (float vectors, double
+ *     dot product).  The messages and the reduction use MPI_ELEM and
+ *     MPI_ACC accordingly; float products are exact in double, so
+ *     with -r the dot product is the exact one rounded once.
+ * 9.  With -e each thread runs the compiled program once over its part
+ *     of the local block, a chunk of EXPR_CHUNK elements at a time, so
+ *     x and y are read once and each output vector written once, and
+ *     intermediate results never go to memory.  Only the vectors the
+ *     program stores are allocated.  The partial results of all the
+ *     reductions travel in one MPI_Ireduce (MPI_Iallreduce with -a),
+ *     with an op that combines each one by its kind.  The time of the
+ *     pass is the compute phase.  -e can't be used with -f, -i or -r.
+ * 10. With -t the four kernels still make four passes, but over one
+ *     tile at a time, so only the first pass over a tile reads x and
+ *     y from memory and the others find them in the L2:  most of the
+ *     traffic saved by -f without a fused kernel.  The dot product
+ *     is only complete after the last tile, so its reduction isn't
+ *     overlapped; the compute phase is the whole tiled pass.  -t
+ *     can't be used with -f or -e.
  */
 
+/* sched_setaffinity, sched_getcpu and CPU_SET in placement.h */
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <mpi.h>
 #include <time.h>
+#include <unistd.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#include "vector_kernels.h"
+#include "placement.h"
+#include "arena.h"
+#include "exact_sum.h"
+#include "vector_expr.h"
+
+/* Number of elements printed from each end of a vector */
+#define PRINT_COUNT 10
+
+/* Weyl sequence increment used by SplitMix64 */
+#define GOLDEN_GAMMA 0x9E3779B97F4A7C15ULL
+
+/* Longest line printed for one process by Report_placement */
+#define PLACEMENT_LINE 512
+
+/* Phases timed on every process and summarized by Report_phases */
+#define PROGRAM "mpi_vector_add3"
+enum {ALLOC, INIT, COMPUTE, DOT, REDUCE, PRINT, PHASE_COUNT};
+char* phase_names[PHASE_COUNT] =
+   {"alloc", "init", "compute", "dot", "reduce", "print"};
+
+/* L2 size assumed by Tile_size when /sys doesn't give it */
+#define DEFAULT_L2 (256 << 10)
+
+/* Longest -e program */
+#define EXPR_TEXT 1024
+
+/* Program run with -e, for Expr_reduce_op */
+Expr_program expr_prog;
+
+/* Run-time settings read from the command line by process 0 */
+typedef struct {
+   int thread_count;  /* threads per process              */
+   int fused;         /* 1: single-pass Fused_vector_ops  */
+   int in_place;      /* 1: scaled vectors overwrite x, y */
+   int report;        /* 1: print thread and page placement */
+   int all_ranks;     /* 1: every process gets the dot product */
+   int exact;         /* 1: reproducible Exact_dot_product */
+   unsigned long long seed;  /* seed for Initialize_vector */
+   char expr[EXPR_TEXT];     /* -e program, "" without -e  */
+   int tiled;         /* 1: Tiled_vector_ops               */
+   long long tile;    /* -t argument, 0 for auto           */
+} Options;
 
 void Check_for_error(int local_ok, char fname[], char message[],
       MPI_Comm comm);
-void Allocate_vectors(double** local_x_pp, double** local_y_pp,
-      double** local_z_pp, int local_n, MPI_Comm comm);
-void Initialize_vector(double local_a[], int local_n, int n, int my_rank, int vector_id);
-void Print_vector(double local_b[], int local_n, int n, char title[],
+void Allocate_vectors(Arena* arena_p, elem_t** local_x_pp,
+      elem_t** local_y_pp, elem_t** local_z_pp, elem_t** scaled_x_pp,
+      elem_t** scaled_y_pp, long long local_n, int in_place,
+      MPI_Comm comm);
+void Allocate_expr_vectors(Arena* arena_p, elem_t* vecs[], int vec_count,
+      long long local_n, MPI_Comm comm);
+void Compile_expression(Expr_program* prog_p, char text[], double scalar,
+      MPI_Comm comm);
+void Evaluate_expression(Expr_program* prog_p, elem_t* vecs[],
+      acc_t local_results[], long long local_n);
+void Expr_reduce_op(void* in, void* inout, int* len_p,
+      MPI_Datatype* type_p);
+void First_touch(elem_t local_a[], long long local_n);
+void Place_threads(int thread_count, int thread_cpus[], int my_rank,
+      MPI_Comm comm);
+void Report_placement(elem_t local_x[], long long local_n,
+      int thread_cpus[], int thread_count, int my_rank, MPI_Comm comm);
+void Initialize_vector(elem_t local_a[], long long local_n, long long n,
+      unsigned long long seed, int vector_id, int my_rank, int comm_sz);
+unsigned long long Mix64(unsigned long long z);
+void Print_vector(elem_t local_b[], long long n, char title[],
       int my_rank, MPI_Comm comm);
-void Parallel_vector_sum(double local_x[], double local_y[],
-      double local_z[], int local_n);
-void Calculate_dot_product(double local_x[], double local_y[], double *local_dot_product, int local_n);
-void Scalar_multiply(double local_a[], double scalar, double local_result[], int local_n);
-void Read_n(int* n_p, int* local_n_p, double* scalar_p, int my_rank, int comm_sz, MPI_Comm comm, int argc, char *argv[]);
+void Gather_slice(elem_t local_b[], long long n, long long first, long long count,
+      elem_t slice[], int tag, int my_rank, MPI_Comm comm);
+void Parallel_vector_sum(elem_t local_x[], elem_t local_y[],
+      elem_t local_z[], long long local_n);
+void Calculate_dot_product(elem_t local_x[], elem_t local_y[], acc_t *local_dot_product, long long local_n);
+void Scalar_multiply(elem_t local_a[], elem_t scalar, elem_t local_result[], long long local_n);
+void Fused_vector_ops(elem_t local_x[], elem_t local_y[], elem_t scalar,
+      elem_t local_z[], elem_t scaled_x[], elem_t scaled_y[],
+      acc_t* local_dot_product, Exact_sum* local_sum, long long local_n,
+      long long tile);
+void Tiled_vector_ops(elem_t local_x[], elem_t local_y[], elem_t scalar,
+      elem_t local_z[], elem_t scaled_x[], elem_t scaled_y[],
+      acc_t* local_dot_product, Exact_sum* local_sum, long long local_n,
+      long long tile);
+long long Tile_size(long long requested, int in_place);
+void Exact_dot_product(elem_t local_x[], elem_t local_y[],
+      Exact_sum* local_sum, long long local_n);
+void Exact_sum_op(void* in, void* inout, int* len_p,
+      MPI_Datatype* type_p);
+void Start_dot_reduction(void* local_dot_product,
+      void* global_dot_product, MPI_Datatype type, MPI_Op op,
+      int all_ranks, MPI_Comm comm, MPI_Request* request_p);
+long long Block_first(long long n, int comm_sz, int q);
+long long Block_size(long long n, int comm_sz, int q);
+int Block_owner(long long n, int comm_sz, long long i);
+void Thread_block(long long n, long long* first_p, long long* count_p);
+double Lap_ms(double* start_p);
+void Report_phases(double phase_ms[], long long n, int threads,
+      int my_rank, MPI_Comm comm);
+void Read_n(long long* n_p, long long* local_n_p, double* scalar_p, Options* opts_p, int my_rank, int comm_sz, MPI_Comm comm, int argc, char *argv[]);
 
 /*-------------------------------------------------------------------*/
 int main(int argc, char *argv[]) {
-   int n; 
-   int local_n;
+   long long n;
+   long long local_n;
    int comm_sz, my_rank;
-   double *local_x, *local_y, *local_z;
+   elem_t *local_x, *local_y, *local_z;
    MPI_Comm comm;
-   double tstart, tend;
+   double tstart, tend, lap;
+   double phase_ms[PHASE_COUNT];
    double scalar; // Variable para almacenar el escalar
+   elem_t *scaled_x, *scaled_y;
+   Options opts;
+   int provided;
+   int* thread_cpus;
+   Arena arena;
+   MPI_Request reduce_request;
+   int reduce_done;
+   Exact_sum local_exact, global_exact;
+   MPI_Datatype exact_type;
+   MPI_Op exact_op;
+   elem_t* vecs[EXPR_VECS];
+   acc_t local_results[EXPR_REDS], global_results[EXPR_REDS];
+   MPI_Datatype results_type;
+   MPI_Op results_op;
+   char title[EXPR_NAME + 16];
+   int v;
+   long long tile = 0;
 
-   MPI_Init(&argc, &argv);
+   // Solo el hilo principal llama a MPI
+   MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &provided);
    comm = MPI_COMM_WORLD;
    MPI_Comm_size(comm, &comm_sz);
    MPI_Comm_rank(comm, &my_rank);
+   if (my_rank == 0 && provided < MPI_THREAD_FUNNELED)
+      fprintf(stderr, "Warning: MPI library doesn't support MPI_THREAD_FUNNELED\n");
 
    // Leer el tamaño del vector y el escalar desde los argumentos de línea de comandos
-   Read_n(&n, &local_n, &scalar, my_rank, comm_sz, comm, argc, argv);
+   Read_n(&n, &local_n, &scalar, &opts, my_rank, comm_sz, comm,
+         argc, argv);
+#  ifdef _OPENMP
+   omp_set_num_threads(opts.thread_count);
+#  endif
+   Select_kernels();
+   Expr_select(Kernels.name);
+   if (my_rank == 0)
+      printf("Using %s kernels on %s vectors\n", Kernels.name, ELEM_NAME);
+   thread_cpus = malloc(opts.thread_count*sizeof(int));
+   Check_for_error(thread_cpus != NULL, "main", "Can't allocate thread_cpus",
+         comm);
+   Place_threads(opts.thread_count, thread_cpus, my_rank, comm);
+   if (opts.tiled || (opts.fused && opts.exact)) {
+      tile = Tile_size(opts.tile, opts.in_place);
+      if (my_rank == 0 && opts.tiled)
+         printf("Tiles of %lld elements%s\n", tile,
+               opts.tile == 0 ? " (from the L2 size)" : "");
+   }
+   // Un Exact_sum viaja como un solo elemento, así MPI no lo parte
+   MPI_Type_contiguous(sizeof(Exact_sum), MPI_BYTE, &exact_type);
+   MPI_Type_commit(&exact_type);
+   MPI_Op_create(Exact_sum_op, 1, &exact_op);
+   if (opts.expr[0] != '\0') {
+      Compile_expression(&expr_prog, opts.expr, scalar, comm);
+      // Los resultados de todas las reducciones forman un solo elemento
+      MPI_Type_contiguous(expr_prog.red_count, MPI_ACC, &results_type);
+      MPI_Type_commit(&results_type);
+      MPI_Op_create(Expr_reduce_op, 1, &results_op);
+   }
 
-   tstart = MPI_Wtime();
-   Allocate_vectors(&local_x, &local_y, &local_z, local_n, comm);
+   tstart = lap = MPI_Wtime();
+   if (opts.expr[0] != '\0') {
+      Allocate_expr_vectors(&arena, vecs, expr_prog.vec_count, local_n,
+            comm);
+      local_x = vecs[0];
+      local_y = vecs[1];
+   } else {
+      Allocate_vectors(&arena, &local_x, &local_y, &local_z, &scaled_x,
+            &scaled_y, local_n, opts.in_place, comm);
+   }
+   phase_ms[ALLOC] = Lap_ms(&lap);
 
    // Se pasa vector_id como 0 para local_x y 1 para local_y
-   Initialize_vector(local_x, local_n, n, my_rank, 0);
-   Initialize_vector(local_y, local_n, n, my_rank, 1);
+   Initialize_vector(local_x, local_n, n, opts.seed, 0, my_rank, comm_sz);
+   Initialize_vector(local_y, local_n, n, opts.seed, 1, my_rank, comm_sz);
+   phase_ms[INIT] = Lap_ms(&lap);
 
-   // Sumar vectores
-   Parallel_vector_sum(local_x, local_y, local_z, local_n);
+   acc_t local_dot_product = 0.0;
+   acc_t global_dot_product = 0.0;
+   if (opts.expr[0] != '\0') {
+      // Todas las sentencias en una sola pasada, y todas las
+      // reducciones en un solo mensaje
+      Evaluate_expression(&expr_prog, vecs, local_results, local_n);
+      phase_ms[COMPUTE] = Lap_ms(&lap);
+      phase_ms[DOT] = 0;
+      if (expr_prog.red_count > 0) {
+         Start_dot_reduction(local_results, global_results, results_type,
+               results_op, opts.all_ranks, comm, &reduce_request);
+         MPI_Wait(&reduce_request, MPI_STATUS_IGNORE);
+         if (opts.all_ranks || my_rank == 0)
+            Expr_finish(&expr_prog, global_results);
+      }
+      phase_ms[REDUCE] = Lap_ms(&lap);
+   } else if (opts.tiled) {
+      // Las cuatro pasadas, un tile a la vez mientras está en la L2
+      Tiled_vector_ops(local_x, local_y, scalar, local_z, scaled_x,
+            scaled_y, &local_dot_product,
+            opts.exact ? &local_exact : NULL, local_n, tile);
+      phase_ms[COMPUTE] = Lap_ms(&lap);
+      phase_ms[DOT] = 0;
+      if (opts.exact)
+         Start_dot_reduction(&local_exact, &global_exact, exact_type,
+               exact_op, opts.all_ranks, comm, &reduce_request);
+      else
+         Start_dot_reduction(&local_dot_product, &global_dot_product,
+               MPI_ACC, MPI_SUM, opts.all_ranks, comm, &reduce_request);
+      MPI_Wait(&reduce_request, MPI_STATUS_IGNORE);
+      phase_ms[REDUCE] = Lap_ms(&lap);
+   } else if (opts.fused) {
+      // Suma, producto punto y escalado en una sola pasada
+      Fused_vector_ops(local_x, local_y, scalar, local_z, scaled_x,
+            scaled_y, &local_dot_product,
+            opts.exact ? &local_exact : NULL, local_n, tile);
+      phase_ms[COMPUTE] = Lap_ms(&lap);
+      phase_ms[DOT] = 0;
+      // No queda trabajo con el que solapar la reducción
+      if (opts.exact)
+         Start_dot_reduction(&local_exact, &global_exact, exact_type,
+               exact_op, opts.all_ranks, comm, &reduce_request);
+      else
+         Start_dot_reduction(&local_dot_product, &global_dot_product,
+               MPI_ACC, MPI_SUM, opts.all_ranks, comm, &reduce_request);
+      MPI_Wait(&reduce_request, MPI_STATUS_IGNORE);
+      phase_ms[REDUCE] = Lap_ms(&lap);
+   } else {
+      // Sumar vectores
+      Parallel_vector_sum(local_x, local_y, local_z, local_n);
+      phase_ms[COMPUTE] = Lap_ms(&lap);
 
-   // Calcular producto punto
-   double local_dot_product = 0.0;
-   Calculate_dot_product(local_x, local_y, &local_dot_product, local_n);
-   double global_dot_product;
-   MPI_Reduce(&local_dot_product, &global_dot_product, 1, MPI_DOUBLE, MPI_SUM, 0, comm);
+      // Calcular producto punto y empezar la reducción
+      if (opts.exact) {
+         Exact_dot_product(local_x, local_y, &local_exact, local_n);
+         Start_dot_reduction(&local_exact, &global_exact, exact_type,
+               exact_op, opts.all_ranks, comm, &reduce_request);
+      } else {
+         Calculate_dot_product(local_x, local_y, &local_dot_product,
+               local_n);
+         Start_dot_reduction(&local_dot_product, &global_dot_product,
+               MPI_ACC, MPI_SUM, opts.all_ranks, comm, &reduce_request);
+      }
+      phase_ms[DOT] = Lap_ms(&lap);
 
-   // Multiplicación de escalar
-   double *scaled_x = malloc(local_n * sizeof(double));
-   double *scaled_y = malloc(local_n * sizeof(double));
-   Scalar_multiply(local_x, scalar, scaled_x, local_n);
-   Scalar_multiply(local_y, scalar, scaled_y, local_n);
+      // Multiplicación de escalar mientras avanza la reducción; el
+      // MPI_Test entre pasadas le da progreso a la biblioteca
+      Scalar_multiply(local_x, scalar, scaled_x, local_n);
+      MPI_Test(&reduce_request, &reduce_done, MPI_STATUS_IGNORE);
+      Scalar_multiply(local_y, scalar, scaled_y, local_n);
+      phase_ms[COMPUTE] += Lap_ms(&lap);
+      MPI_Wait(&reduce_request, MPI_STATUS_IGNORE);
+      phase_ms[REDUCE] = Lap_ms(&lap);
+   }
+   if (opts.exact && (opts.all_ranks || my_rank == 0))
+      global_dot_product = Exact_sum_value(&global_exact);
 
    tend = MPI_Wtime();
+   if (my_rank == 0)
+      printf("Vectors in a %s arena\n", Arena_kind_name(&arena));
 
    // Imprimir resultados
-   Print_vector(local_x, local_n, n, "\nVector x", my_rank, comm);
-   Print_vector(local_y, local_n, n, "\nVector y", my_rank, comm);
-   Print_vector(local_z, local_n, n, "\nThe sum is", my_rank, comm);
-   Print_vector(scaled_x, local_n, n, "\nScaled Vector x", my_rank, comm);
-   Print_vector(scaled_y, local_n, n, "\nScaled Vector y", my_rank, comm);
+   if (opts.expr[0] != '\0') {
+      for (v = 0; v < expr_prog.vec_count; v++) {
+         sprintf(title, "\nVector %s", expr_prog.vec_names[v]);
+         Print_vector(vecs[v], n, title, my_rank, comm);
+      }
+   } else {
+      if (!opts.in_place) {
+         Print_vector(local_x, n, "\nVector x", my_rank, comm);
+         Print_vector(local_y, n, "\nVector y", my_rank, comm);
+      }
+      Print_vector(local_z, n, "\nThe sum is", my_rank, comm);
+      Print_vector(scaled_x, n, "\nScaled Vector x", my_rank,
+            comm);
+      Print_vector(scaled_y, n, "\nScaled Vector y", my_rank,
+            comm);
+   }
+   phase_ms[PRINT] = Lap_ms(&lap);
 
-   if(my_rank == 0)
-       printf("\nGlobal dot product = %f\n", global_dot_product);
+   if (my_rank == 0 && opts.expr[0] != '\0') {
+      for (v = 0; v < expr_prog.red_count; v++)
+         printf("%s%s = %f%s\n", v == 0 ? "\n" : "",
+               expr_prog.red_names[v], (double) global_results[v],
+               opts.all_ranks ? " (on every process)" : "");
+   } else if (my_rank == 0) {
+       printf("\nGlobal dot product = %f%s%s\n", global_dot_product,
+             opts.all_ranks ? " (on every process)" : "",
+             opts.exact ? " (reproducible)" : "");
+   }
+   if (my_rank == 0 && opts.exact)
+       printf("Bits of the dot product: %a\n", global_dot_product);
 
    double cpu_time_used = ((double) (tend - tstart)) * 1000;
    if(my_rank == 0)
        printf("\nTook %f ms to run\n", cpu_time_used);
+   Report_phases(phase_ms, n, opts.thread_count, my_rank, comm);
+   if (opts.report)
+      Report_placement(local_x, local_n, thread_cpus, opts.thread_count,
+            my_rank, comm);
 
-   free(local_x);
-   free(local_y);
-   free(local_z);
-   free(scaled_x);
-   free(scaled_y);
+   Arena_free(&arena);
+   free(thread_cpus);
+   MPI_Op_free(&exact_op);
+   MPI_Type_free(&exact_type);
+   if (opts.expr[0] != '\0') {
+      MPI_Op_free(&results_op);
+      MPI_Type_free(&results_type);
+   }
 
    MPI_Finalize();
 
@@ -123,6 +445,61 @@ void Check_for_error(
    }
 }  /* Check_for_error */
 
+/*-------------------------------------------------------------------
+ * Function:  Block_first
+ * Purpose:   Find the global index of the first element assigned to
+ *            process q by the balanced block distribution
+ * In args:   n:        order of global vector
+ *            comm_sz:  number of processes
+ *            q:        rank of the process
+ *
+ * Note:
+ *    The first n % comm_sz processes get n/comm_sz + 1 elements and
+ *    the others get n/comm_sz, so n need not be divisible by comm_sz.
+ */
+long long Block_first(
+      long long  n        /* in */,
+      int        comm_sz  /* in */,
+      int        q        /* in */) {
+   long long quotient = n/comm_sz, remainder = n % comm_sz;
+
+   return q*quotient + (q < remainder ? q : remainder);
+}  /* Block_first */
+
+/*-------------------------------------------------------------------
+ * Function:  Block_size
+ * Purpose:   Find the number of elements assigned to process q by the
+ *            balanced block distribution
+ * In args:   n:        order of global vector
+ *            comm_sz:  number of processes
+ *            q:        rank of the process
+ */
+long long Block_size(
+      long long  n        /* in */,
+      int        comm_sz  /* in */,
+      int        q        /* in */) {
+   return n/comm_sz + (q < n % comm_sz ? 1 : 0);
+}  /* Block_size */
+
+/*-------------------------------------------------------------------
+ * Function:  Block_owner
+ * Purpose:   Find the process that owns global element i under the
+ *            balanced block distribution
+ * In args:   n:        order of global vector
+ *            comm_sz:  number of processes
+ *            i:        global index, 0 <= i < n
+ */
+int Block_owner(
+      long long  n        /* in */,
+      int        comm_sz  /* in */,
+      long long  i        /* in */) {
+   long long quotient = n/comm_sz, remainder = n % comm_sz;
+   long long split = remainder*(quotient + 1);
+
+   if (i < split) return i/(quotient + 1);
+   return remainder + (i - split)/quotient;
+}  /* Block_owner */
+
 /*-------------------------------------------------------------------
  * Function:  Read_n
  * Purpose:   Get the order of the vectors and the scalar from command line arguments
@@ -132,138 +509,499 @@ void Check_for_error(
  *            comm:       communicator containing all the processes
  *                        calling Read_n
  * Out args:  n_p:        global value of n
- *            local_n_p:  local value of n = n/comm_sz
+ *            local_n_p:  number of elements in this process' block
  *            scalar_p:   value of the scalar
+ *            opts_p:     -a, -e, -f, -i, -p, -r, -s and -t flags, and the number of threads
+ *                        per process (optional third argument,
+ *                        default OMP_NUM_THREADS)
  *
- * Errors:    n should be positive and evenly divisible by comm_sz
+ * Errors:    n and the thread count should be positive, -e can't be
+ *            combined with -f, -i or -r, and -t can't be combined with
+ *            -f or -e
  */
 void Read_n(
-      int*      n_p        /* out */,
-      int*      local_n_p  /* out */,
-      double*   scalar_p    /* out */,
-      int       my_rank    /* in  */,
-      int       comm_sz    /* in  */,
-      MPI_Comm  comm       /* in  */,
-      int       argc,
-      char*     argv[]) {
+      long long* n_p        /* out */,
+      long long* local_n_p  /* out */,
+      double*    scalar_p    /* out */,
+      Options*   opts_p     /* out */,
+      int        my_rank    /* in  */,
+      int        comm_sz    /* in  */,
+      MPI_Comm   comm       /* in  */,
+      int        argc,
+      char*      argv[]) {
    int local_ok = 1;
+   int c;
    char *fname = "Read_n";
 
    if (my_rank == 0) {
-      if (argc < 3) { // Cambiado a 3 para incluir el escalar
-         fprintf(stderr, "Usage: %s <number_of_elements> <scalar>\n", argv[0]);
+      memset(opts_p, 0, sizeof(Options));
+      opts_p->seed = (unsigned long long) time(NULL);
+      while ((c = getopt(argc, argv, "ae:fiprs:t:")) != -1) {
+         if (c == 'a') opts_p->all_ranks = 1;
+         else if (c == 'e' && strlen(optarg) < EXPR_TEXT)
+            strcpy(opts_p->expr, optarg);
+         else if (c == 'f') opts_p->fused = 1;
+         else if (c == 'i') opts_p->in_place = 1;
+         else if (c == 'p') opts_p->report = 1;
+         else if (c == 'r') opts_p->exact = 1;
+         else if (c == 's') opts_p->seed = strtoull(optarg, NULL, 10);
+         else if (c == 't') {
+            opts_p->tiled = 1;
+            opts_p->tile = strtoll(optarg, NULL, 10);
+         }
+         else argc = 0;
+      }
+      if (argc - optind < 2) { // Cambiado a 2 para incluir el escalar
+         fprintf(stderr, "Usage: %s [-a] [-e program] [-f] [-i] [-p] [-r] [-s seed] [-t tile] <number_of_elements> <scalar> [threads]\n", argv[0]);
          MPI_Abort(comm, 1);
       }
-      *n_p = atoi(argv[1]);
-      *scalar_p = atof(argv[2]); // Leer el escalar
-      printf("Proc 0 read n = %d and scalar = %f\n", *n_p, *scalar_p);
+      *n_p = strtoll(argv[optind], NULL, 10);
+      *scalar_p = atof(argv[optind+1]); // Leer el escalar
+#     ifdef _OPENMP
+      opts_p->thread_count = argc - optind > 2 ? atoi(argv[optind+2])
+         : omp_get_max_threads();
+#     else
+      opts_p->thread_count = 1;
+#     endif
+      printf("Proc 0 read n = %lld and scalar = %f, seed = %llu\n", *n_p,
+            *scalar_p, opts_p->seed);
+      printf("Using %d processes x %d threads%s%s%s%s\n", comm_sz,
+            opts_p->thread_count, opts_p->fused ? ", fused" : "",
+            opts_p->tiled ? ", tiled" : "",
+            opts_p->in_place ? ", in place" : "",
+            opts_p->exact ? ", reproducible dot product" : "");
+      if (opts_p->expr[0] != '\0')
+         printf("Program:  %s\n", opts_p->expr);
    }
 
    // Comunicar el tamaño y el escalar a todos los procesos
-   MPI_Bcast(n_p, 1, MPI_INT, 0, comm);
+   MPI_Bcast(n_p, 1, MPI_LONG_LONG, 0, comm);
    MPI_Bcast(scalar_p, 1, MPI_DOUBLE, 0, comm);
+   MPI_Bcast(opts_p, sizeof(Options), MPI_BYTE, 0, comm);
 
-   if (*n_p <= 0 || *n_p % comm_sz != 0) local_ok = 0;
+   if (*n_p <= 0 || opts_p->thread_count <= 0) local_ok = 0;
    Check_for_error(local_ok, fname,
-         "n should be > 0 and evenly divisible by comm_sz", comm);
-   *local_n_p = *n_p / comm_sz;
+         "n and the thread count should be > 0", comm);
+   if (opts_p->expr[0] != '\0' && (opts_p->fused || opts_p->in_place
+            || opts_p->exact)) local_ok = 0;
+   Check_for_error(local_ok, fname, "-e can't be used with -f, -i or -r",
+         comm);
+   if (opts_p->tiled && (opts_p->fused || opts_p->expr[0] != '\0'
+            || opts_p->tile < 0)) local_ok = 0;
+   Check_for_error(local_ok, fname,
+         "-t can't be used with -f or -e, and the tile should be >= 0",
+         comm);
+   *local_n_p = Block_size(*n_p, comm_sz, my_rank);
 }  /* Read_n */
 
 /*-------------------------------------------------------------------
  * Function:  Allocate_vectors
- * Purpose:   Allocate storage for x, y, and z
- * In args:   local_n:  the size of the local vectors
- *            comm:     the communicator containing the calling processes
- * Out args:  local_x_pp, local_y_pp, local_z_pp:  pointers to memory
- *               blocks to be allocated for local vectors
+ * Purpose:   Allocate storage for x, y, z and the scaled vectors from
+ *            one arena
+ * In args:   local_n:   the size of the local vectors
+ *            in_place:  1 if the scaled vectors overwrite x and y
+ *            comm:      the communicator containing the calling processes
+ * Out args:  arena_p:   the arena; Arena_free releases every vector
+ *            local_x_pp, local_y_pp, local_z_pp, scaled_x_pp,
+ *               scaled_y_pp:  pointers to the local vectors (with
+ *               in_place, *scaled_x_pp = *local_x_pp and
+ *               *scaled_y_pp = *local_y_pp)
  *
- * Errors:    One or more of the calls to malloc fails
+ * Errors:    The arena can't be reserved
+ *
+ * Note:
+ *    The vectors are placed with First_touch.
  */
 void Allocate_vectors(
-      double**   local_x_pp  /* out */,
-      double**   local_y_pp  /* out */,
-      double**   local_z_pp  /* out */,
-      int        local_n     /* in  */,
-      MPI_Comm   comm        /* in  */) {
+      Arena*     arena_p      /* out */,
+      elem_t**   local_x_pp   /* out */,
+      elem_t**   local_y_pp   /* out */,
+      elem_t**   local_z_pp   /* out */,
+      elem_t**   scaled_x_pp  /* out */,
+      elem_t**   scaled_y_pp  /* out */,
+      long long  local_n      /* in  */,
+      int        in_place     /* in  */,
+      MPI_Comm   comm         /* in  */) {
    int local_ok = 1;
    char* fname = "Allocate_vectors";
+   size_t bytes = (size_t) local_n*sizeof(elem_t);
 
-   *local_x_pp = malloc(local_n*sizeof(double));
-   *local_y_pp = malloc(local_n*sizeof(double));
-   *local_z_pp = malloc(local_n*sizeof(double));
-
-   if (*local_x_pp == NULL || *local_y_pp == NULL ||
-       *local_z_pp == NULL) local_ok = 0;
+   if (Arena_init(arena_p, Arena_size(bytes, in_place ? 3 : 5)) != 0)
+      local_ok = 0;
    Check_for_error(local_ok, fname, "Can't allocate local vector(s)",
          comm);
+   *local_x_pp = Arena_alloc(arena_p, bytes);
+   *local_y_pp = Arena_alloc(arena_p, bytes);
+   *local_z_pp = Arena_alloc(arena_p, bytes);
+   if (in_place) {
+      *scaled_x_pp = *local_x_pp;
+      *scaled_y_pp = *local_y_pp;
+   } else {
+      *scaled_x_pp = Arena_alloc(arena_p, bytes);
+      *scaled_y_pp = Arena_alloc(arena_p, bytes);
+   }
+
+   First_touch(*local_x_pp, local_n);
+   First_touch(*local_y_pp, local_n);
+   First_touch(*local_z_pp, local_n);
+   if (!in_place) {
+      First_touch(*scaled_x_pp, local_n);
+      First_touch(*scaled_y_pp, local_n);
+   }
 }  /* Allocate_vectors */
 
+/*-------------------------------------------------------------------
+ * Function:  Allocate_expr_vectors
+ * Purpose:   Allocate storage for x, y and the vectors stored by a -e
+ *            program from one arena
+ * In args:   vec_count:  number of vectors, x and y included
+ *            local_n:    the size of the local vectors
+ *            comm:       the communicator containing the calling
+ *                        processes
+ * Out args:  arena_p:    the arena; Arena_free releases every vector
+ *            vecs:       the local vectors, x and y first
+ *
+ * Errors:    The arena can't be reserved
+ *
+ * Note:
+ *    The vectors are placed with First_touch.
+ */
+void Allocate_expr_vectors(
+      Arena*     arena_p     /* out */,
+      elem_t*    vecs[]      /* out */,
+      int        vec_count   /* in  */,
+      long long  local_n     /* in  */,
+      MPI_Comm   comm        /* in  */) {
+   int local_ok = 1;
+   char* fname = "Allocate_expr_vectors";
+   size_t bytes = (size_t) local_n*sizeof(elem_t);
+   int v;
+
+   if (Arena_init(arena_p, Arena_size(bytes, vec_count)) != 0)
+      local_ok = 0;
+   Check_for_error(local_ok, fname, "Can't allocate local vector(s)",
+         comm);
+   for (v = 0; v < vec_count; v++) {
+      vecs[v] = Arena_alloc(arena_p, bytes);
+      First_touch(vecs[v], local_n);
+   }
+}  /* Allocate_expr_vectors */
+
+/*-------------------------------------------------------------------
+ * Function:  Compile_expression
+ * Purpose:   Compile a -e program over the vectors x and y and the
+ *            scalar a
+ * In args:   text:    the program
+ *            scalar:  value of a
+ *            comm:    communicator containing all the processes
+ * Out arg:   prog_p:  the program
+ *
+ * Errors:    The program has a syntax error, or uses more vectors,
+ *            reductions or registers than vector_expr.h allows
+ *
+ * Note:
+ *    Every process compiles the same text, so they all get the same
+ *    program and the same error.
+ */
+void Compile_expression(
+      Expr_program*  prog_p  /* out */,
+      char           text[]  /* in  */,
+      double         scalar  /* in  */,
+      MPI_Comm       comm    /* in  */) {
+   const char* inputs[] = {"x", "y"};
+   const char* scalar_names[] = {"a"};
+   int local_ok = 1;
+   char *fname = "Compile_expression";
+
+   if (Expr_compile(prog_p, text, inputs, 2, scalar_names, &scalar, 1) != 0)
+      local_ok = 0;
+   Check_for_error(local_ok, fname, prog_p->error, comm);
+}  /* Compile_expression */
+
+/*-------------------------------------------------------------------
+ * Function:  First_touch
+ * Purpose:   Write one element of every page of a new vector from the
+ *            thread whose Thread_block contains it, so the OS's
+ *            first-touch policy puts each thread's part on its node
+ * In arg:    local_n:  size of the vector
+ * Out arg:   local_a:  the vector, zeroed on each page touched
+ */
+void First_touch(
+      elem_t     local_a[]  /* out */,
+      long long  local_n    /* in  */) {
+   long long step = sysconf(_SC_PAGESIZE)/sizeof(elem_t);
+
+#  pragma omp parallel
+   {
+      long long first, count, i;
+      Thread_block(local_n, &first, &count);
+      for (i = first; i < first + count; i += step)
+         local_a[i] = 0.0;
+      if (count > 0) local_a[first + count - 1] = 0.0;
+   }
+}  /* First_touch */
+
+/*-------------------------------------------------------------------
+ * Function:  Place_threads
+ * Purpose:   Pin every thread of every process on a node to a CPU
+ *            following the VECTOR_PIN policy (see placement.h)
+ * In args:   thread_count:  threads per process
+ *            my_rank:       rank of calling process
+ *            comm:          communicator containing all processes
+ * Out arg:   thread_cpus:   CPU each thread is running on afterwards
+ *
+ * Note:
+ *    The processes on a node with the same affinity mask (all of them,
+ *    if mpiexec doesn't bind) share its CPUs:  thread t of the k-th of
+ *    them gets slot k*thread_count + t.  The thread team must already
+ *    have its final size, so the pinned threads run the kernels.
+ */
+void Place_threads(
+      int       thread_count   /* in  */,
+      int       thread_cpus[]  /* out */,
+      int       my_rank        /* in  */,
+      MPI_Comm  comm           /* in  */) {
+   static Cpu_info cpus[MAX_CPUS];
+   int count = Get_cpus(cpus), policy = Pin_policy();
+   int local_rank, local_size, i;
+   unsigned key = 0;
+   MPI_Comm node_comm, share_comm;
+
+   MPI_Comm_split_type(comm, MPI_COMM_TYPE_SHARED, my_rank, MPI_INFO_NULL,
+         &node_comm);
+   for (i = 0; i < count; i++)
+      key = 31*key + cpus[i].cpu + 1;
+   MPI_Comm_split(node_comm, (int) (key & 0x7FFFFFFF), my_rank,
+         &share_comm);
+   MPI_Comm_rank(share_comm, &local_rank);
+   MPI_Comm_size(share_comm, &local_size);
+   MPI_Comm_free(&share_comm);
+   MPI_Comm_free(&node_comm);
+
+#  pragma omp parallel
+   {
+#     ifdef _OPENMP
+      int t = omp_get_thread_num();
+#     else
+      int t = 0;
+#     endif
+      if (policy != PIN_NONE && count > 0)
+         Pin_to_cpu(cpus[Choose_cpu(count, local_rank*thread_count + t,
+                  local_size*thread_count, policy)].cpu);
+      thread_cpus[t] = Current_cpu();
+   }
+}  /* Place_threads */
+
+/*-------------------------------------------------------------------
+ * Function:  Report_placement
+ * Purpose:   Print, for every process, the CPU and NUMA node of each
+ *            of its threads and the nodes holding the pages of x
+ * In args:   local_x:       this process' block of x
+ *            local_n:       size of local vectors
+ *            thread_cpus:   from Place_threads
+ *            thread_count:  threads per process
+ *            my_rank:       rank of calling process
+ *            comm:          communicator containing all processes
+ */
+void Report_placement(
+      elem_t     local_x[]      /* in */,
+      long long  local_n        /* in */,
+      int        thread_cpus[]  /* in */,
+      int        thread_count   /* in */,
+      int        my_rank        /* in */,
+      MPI_Comm   comm           /* in */) {
+   char line[PLACEMENT_LINE], host[MPI_MAX_PROCESSOR_NAME];
+   char* lines = NULL;
+   int counts[MAX_NODES];
+   int comm_sz, len, t, node, sampled, q;
+
+   MPI_Comm_size(comm, &comm_sz);
+   MPI_Get_processor_name(host, &len);
+   len = snprintf(line, PLACEMENT_LINE, "Proc %d on %s: threads on cpu",
+         my_rank, host);
+   for (t = 0; t < thread_count && len < PLACEMENT_LINE; t++)
+      len += snprintf(line + len, PLACEMENT_LINE - len, " %d (node %d)",
+            thread_cpus[t], Cpu_node(thread_cpus[t]));
+   sampled = Page_nodes(local_x, (size_t) local_n*sizeof(elem_t), 1024,
+         counts);
+   if (len < PLACEMENT_LINE)
+      len += snprintf(line + len, PLACEMENT_LINE - len, "; x pages on");
+   for (node = 0; node < MAX_NODES && len < PLACEMENT_LINE; node++)
+      if (counts[node] > 0)
+         len += snprintf(line + len, PLACEMENT_LINE - len,
+               " node %d: %.0f%%", node, 100.0*counts[node]/sampled);
+   if (sampled == 0 && len < PLACEMENT_LINE)
+      snprintf(line + len, PLACEMENT_LINE - len, " (unknown)");
+
+   if (my_rank == 0) {
+      lines = malloc((size_t) comm_sz*PLACEMENT_LINE);
+      Check_for_error(lines != NULL, "Report_placement",
+            "Can't allocate lines", comm);
+   } else {
+      Check_for_error(1, "Report_placement", "Can't allocate lines", comm);
+   }
+   MPI_Gather(line, PLACEMENT_LINE, MPI_CHAR, lines, PLACEMENT_LINE,
+         MPI_CHAR, 0, comm);
+   if (my_rank == 0) {
+      for (q = 0; q < comm_sz; q++)
+         printf("%s\n", lines + (size_t) q*PLACEMENT_LINE);
+      free(lines);
+   }
+}  /* Report_placement */
+
 /*-------------------------------------------------------------------
  * Function:  Initialize_vector
- * Purpose:   Initialize a vector with random values
+ * Purpose:   Initialize a vector with random values between 0 and 99
+ * In args:   local_n:    size of local vector
+ *            n:          size of global vector
+ *            seed:       seed shared by all processes
+ *            vector_id:  0 for x, 1 for y
+ *            my_rank:    rank of calling process
+ *            comm_sz:    number of processes
+ * Out arg:   local_a:    this process' block of the vector
+ *
+ * Note:
+ *    Element i is a counter-based function of (seed, vector_id, i), the
+ *    global index, so the vector is the same for every comm_sz and
+ *    different vectors never share a stream.  Each thread fills its
+ *    Thread_block, the part it touched in First_touch.
  */
 void Initialize_vector(
-      double local_a[]   /* out */,
-      int    local_n     /* in  */,
-      int    n           /* in  */,
-      int    my_rank     /* in  */,
-      int    vector_id   /* in  */) {
-   int i;
+      elem_t              local_a[]   /* out */,
+      long long           local_n     /* in  */,
+      long long           n           /* in  */,
+      unsigned long long  seed        /* in  */,
+      int                 vector_id   /* in  */,
+      int                 my_rank     /* in  */,
+      int                 comm_sz     /* in  */) {
+   long long first = Block_first(n, comm_sz, my_rank);
+   unsigned long long key = Mix64(seed + GOLDEN_GAMMA*(vector_id + 1));
 
-   // Se usa vector_id para crear diferentes semillas para diferentes vectores
-   srand(time(NULL) + vector_id + my_rank);
-
-   for (i = 0; i < local_n; i++) {
-      local_a[i] = (double)(rand() % 100);  // Cambiar el rango según sea necesario
+#  pragma omp parallel
+   {
+      unsigned long long r;
+      long long t_first, t_count, i;
+      Thread_block(local_n, &t_first, &t_count);
+      for (i = t_first; i < t_first + t_count; i++) {
+         r = Mix64(key + GOLDEN_GAMMA*(unsigned long long) (first + i));
+         local_a[i] = (elem_t) (((r >> 11) * 100) >> 53);
+      }
    }
 }  /* Initialize_vector */
 
+/*-------------------------------------------------------------------
+ * Function:  Mix64
+ * Purpose:   SplitMix64 finalizer:  scramble the bits of a 64-bit word
+ */
+unsigned long long Mix64(unsigned long long z /* in */) {
+   z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+   z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+   return z ^ (z >> 31);
+}  /* Mix64 */
+
 /*-------------------------------------------------------------------
  * Function:  Print_vector
- * Purpose:   Print the elements of the vector
- * In args:   local_b:   local portion of vector
- *            local_n:   local size of the vector
- *            n:         global size of the vector
- *            title:     title to print before the vector
- *            my_rank:   rank of calling process
- *            comm:      communicator containing all processes calling
- *                        Print_vector
+ * Purpose:   Print the first and last PRINT_COUNT elements of a vector
+ *            that has a block distribution
+ * In args:   local_b:  local storage for vector to be printed
+ *            n:        order of global vector
+ *            title:    title to precede print out
+ *            my_rank:  rank of calling process
+ *            comm:     communicator containing processes calling
+ *                      Print_vector
+ *
+ * Note:
+ *    Only the ranks owning the head or the tail of the vector send
+ *    anything, so process 0 never needs more than 2*PRINT_COUNT
+ *    elements of temporary storage.
  */
 void Print_vector(
-      double    local_b[]  /* in */,
-      int       local_n    /* in */,
-      int       n          /* in */,
+      elem_t    local_b[]  /* in */,
+      long long n          /* in */,
       char      title[]    /* in */,
       int       my_rank    /* in */,
       MPI_Comm  comm       /* in */) {
 
-   double* b = NULL;
+   elem_t head[PRINT_COUNT], tail[PRINT_COUNT];
+   int count = n < PRINT_COUNT ? (int) n : PRINT_COUNT;
    int i;
-   int local_ok = 1;
-   char* fname = "Print_vector";
+
+   Gather_slice(local_b, n, 0, count, head, 0, my_rank, comm);
+   Gather_slice(local_b, n, n - count, count, tail, 1, my_rank, comm);
 
    if (my_rank == 0) {
-      b = malloc(n*sizeof(double));
-      MPI_Gather(local_b, local_n, MPI_DOUBLE, b, local_n, MPI_DOUBLE, 0, comm);
       printf("%s:\n", title);
 
       // Imprimir primeros 10 elementos
-      printf("First 10 elements: ");
-      for (i = 0; i < 10 && i < n; i++)
-         printf("%f ", b[i]);
+      printf("First %d elements: ", count);
+      for (i = 0; i < count; i++)
+         printf(ELEM_FMT " ", head[i]);
       printf("\n");
 
       // Imprimir últimos 10 elementos
-      printf("Last 10 elements: ");
-      for (i = n-10; i < n; i++)
-         printf("%f ", b[i]);
+      printf("Last %d elements: ", count);
+      for (i = 0; i < count; i++)
+         printf(ELEM_FMT " ", tail[i]);
       printf("\n");
+   }
+}  /* Print_vector */
+
+/*-------------------------------------------------------------------
+ * Function:  Gather_slice
+ * Purpose:   Collect the global elements first, ..., first+count-1 of
+ *            a block distributed vector on process 0 using
+ *            point-to-point messages from the processes that own them
+ * In args:   local_b:  local storage for the distributed vector
+ *            n:        order of global vector
+ *            first:    global index of the first element wanted
+ *            count:    number of elements wanted
+ *            tag:      message tag used for this slice
+ *            my_rank:  rank of calling process
+ *            comm:     communicator containing processes calling
+ *                      Gather_slice
+ * Out arg:   slice:    on process 0, the count requested elements
+ */
+void Gather_slice(
+      elem_t    local_b[]  /* in  */,
+      long long n          /* in  */,
+      long long first      /* in  */,
+      long long count      /* in  */,
+      elem_t    slice[]    /* out */,
+      int       tag        /* in  */,
+      int       my_rank    /* in  */,
+      MPI_Comm  comm       /* in  */) {
+   int comm_sz, q;
+   long long q_first, lo, hi;
+   long long last = first + count;
 
-      free(b);
+   if (count <= 0) return;
+   MPI_Comm_size(comm, &comm_sz);
+
+   if (my_rank == 0) {
+      for (q = Block_owner(n, comm_sz, first);
+            q < comm_sz && Block_first(n, comm_sz, q) < last; q++) {
+         q_first = Block_first(n, comm_sz, q);
+         lo = q_first > first ? q_first : first;
+         hi = q_first + Block_size(n, comm_sz, q);
+         if (hi > last) hi = last;
+         if (lo >= hi) continue;
+         if (q == 0)
+            memcpy(slice + (lo - first), local_b + lo,
+                  (hi - lo)*sizeof(elem_t));
+         else
+            MPI_Recv(slice + (lo - first), (int) (hi - lo), MPI_ELEM,
+                  q, tag, comm, MPI_STATUS_IGNORE);
+      }
    } else {
-      MPI_Gather(local_b, local_n, MPI_DOUBLE, b, local_n, MPI_DOUBLE, 0, comm);
+      q_first = Block_first(n, comm_sz, my_rank);
+      lo = q_first > first ? q_first : first;
+      hi = q_first + Block_size(n, comm_sz, my_rank);
+      if (hi > last) hi = last;
+      if (lo < hi)
+         MPI_Send(local_b + (lo - q_first), (int) (hi - lo), MPI_ELEM,
+               0, tag, comm);
    }
-}  /* Print_vector */
+}  /* Gather_slice */
 
 /*-------------------------------------------------------------------
  * Function:  Parallel_vector_sum
@@ -274,13 +1012,16 @@ void Print_vector(
  *            local_n: size of local vectors
  */
 void Parallel_vector_sum(
-      double local_x[]   /* in */,
-      double local_y[]   /* in */,
-      double local_z[]   /* out */,
-      int    local_n     /* in */) {
-   int i;
-   for (i = 0; i < local_n; i++)
-      local_z[i] = local_x[i] + local_y[i];
+      elem_t     local_x[]   /* in */,
+      elem_t     local_y[]   /* in */,
+      elem_t     local_z[]   /* out */,
+      long long  local_n     /* in */) {
+#  pragma omp parallel
+   {
+      long long first, count;
+      Thread_block(local_n, &first, &count);
+      Kernels.sum(local_x + first, local_y + first, local_z + first, count);
+   }
 }  /* Parallel_vector_sum */
 
 /*-------------------------------------------------------------------
@@ -292,14 +1033,18 @@ void Parallel_vector_sum(
  *            local_n: size of local vectors
  */
 void Calculate_dot_product(
-      double local_x[]   /* in */,
-      double local_y[]   /* in */,
-      double* local_dot_product /* out */,
-      int    local_n     /* in */) {
-   int i;
-   *local_dot_product = 0.0;
-   for (i = 0; i < local_n; i++)
-      *local_dot_product += local_x[i] * local_y[i];
+      elem_t     local_x[]   /* in */,
+      elem_t     local_y[]   /* in */,
+      acc_t*     local_dot_product /* out */,
+      long long  local_n     /* in */) {
+   acc_t sum = 0.0;
+#  pragma omp parallel reduction(+: sum)
+   {
+      long long first, count;
+      Thread_block(local_n, &first, &count);
+      sum += Kernels.dot(local_x + first, local_y + first, count);
+   }
+   *local_dot_product = sum;
 }  /* Calculate_dot_product */
 
 /*-------------------------------------------------------------------
@@ -311,11 +1056,389 @@ void Calculate_dot_product(
  *            local_n: size of local vector
  */
 void Scalar_multiply(
-      double local_a[]   /* in */,
-      double scalar      /* in */,
-      double local_result[] /* out */,
-      int local_n        /* in */) {
-   int i;
-   for (i = 0; i < local_n; i++)
-      local_result[i] = scalar * local_a[i];
+      elem_t     local_a[]   /* in */,
+      elem_t     scalar      /* in */,
+      elem_t     local_result[] /* out */,
+      long long  local_n     /* in */) {
+#  pragma omp parallel
+   {
+      long long first, count;
+      Thread_block(local_n, &first, &count);
+      Kernels.scale(local_a + first, scalar, local_result + first, count);
+   }
 }  /* Scalar_multiply */
+
+/*-------------------------------------------------------------------
+ * Function:  Fused_vector_ops
+ * Purpose:   Compute the sum, the local dot product and both scaled
+ *            vectors in a single pass over x and y
+ * In args:   local_x: local portion of x
+ *            local_y: local portion of y
+ *            scalar: scalar value
+ *            local_n: size of local vectors
+ * Out args:  local_z: local portion of z = x + y
+ *            scaled_x: scalar*x (may be local_x itself)
+ *            scaled_y: scalar*y (may be local_y itself)
+ *            local_dot_product: pointer to store local dot product
+ *            local_sum: with -r, the exact dot product (see
+ *               Exact_dot_product); NULL otherwise
+ *            tile: with -r, elements per tile
+ *
+ * Note:
+ *    Reads 2 and writes 3 vector streams, against 9 for the separate
+ *    Parallel_vector_sum, Calculate_dot_product and Scalar_multiply
+ *    passes.  With -r each thread runs Exact_dot on a tile of its
+ *    Thread_block and then Kernels.fused on the same tile, which
+ *    finds x and y in the L2 (see Tile_size) and may overwrite them.
+ */
+void Fused_vector_ops(
+      elem_t     local_x[]   /* in  */,
+      elem_t     local_y[]   /* in  */,
+      elem_t     scalar      /* in  */,
+      elem_t     local_z[]   /* out */,
+      elem_t     scaled_x[]  /* out */,
+      elem_t     scaled_y[]  /* out */,
+      acc_t*     local_dot_product /* out */,
+      Exact_sum* local_sum   /* out */,
+      long long  local_n     /* in  */,
+      long long  tile        /* in  */) {
+   acc_t sum = 0.0;
+
+   if (local_sum != NULL) Exact_sum_init(local_sum);
+#  pragma omp parallel reduction(+: sum)
+   {
+      long long first, count, i, len;
+      Exact_sum my_sum;
+
+      Thread_block(local_n, &first, &count);
+      if (local_sum == NULL) {
+         sum += Kernels.fused(local_x + first, local_y + first, scalar,
+               local_z + first, scaled_x + first, scaled_y + first, count);
+      } else {
+         // El producto punto exacto antes de que Kernels.fused pueda
+         // sobrescribir x e y; el suyo se descarta
+         Exact_sum_init(&my_sum);
+         for (i = first; i < first + count; i += len) {
+            len = first + count - i < tile ? first + count - i : tile;
+            Exact_dot(&my_sum, local_x + i, local_y + i, len);
+            Exact_sum_normalize(&my_sum);
+            Kernels.fused(local_x + i, local_y + i, scalar, local_z + i,
+                  scaled_x + i, scaled_y + i, len);
+         }
+#        pragma omp critical
+         Exact_sum_merge(local_sum, &my_sum);
+      }
+   }
+   *local_dot_product = sum;
+}  /* Fused_vector_ops */
+
+/*-------------------------------------------------------------------
+ * Function:  Tiled_vector_ops
+ * Purpose:   Compute the sum, the local dot product and both scaled
+ *            vectors with the separate kernels, one tile at a time
+ * In args:   local_x: local portion of x
+ *            local_y: local portion of y
+ *            scalar: scalar value
+ *            local_n: size of local vectors
+ *            tile: elements per tile
+ * Out args:  local_z: local portion of z = x + y
+ *            scaled_x: scalar*x (may be local_x itself)
+ *            scaled_y: scalar*y (may be local_y itself)
+ *            local_dot_product: pointer to store local dot product
+ *            local_sum: with -r, the exact dot product (see
+ *               Exact_dot_product); NULL otherwise
+ *
+ * Note:
+ *    Each thread runs Kernels.sum, Kernels.dot (or Exact_dot) and
+ *    Kernels.scale twice on a tile of its Thread_block before going
+ *    on to the next one, so the kernels after the first find x and y
+ *    in the thread's L2 (see Tile_size).
+ */
+void Tiled_vector_ops(
+      elem_t     local_x[]   /* in  */,
+      elem_t     local_y[]   /* in  */,
+      elem_t     scalar      /* in  */,
+      elem_t     local_z[]   /* out */,
+      elem_t     scaled_x[]  /* out */,
+      elem_t     scaled_y[]  /* out */,
+      acc_t*     local_dot_product /* out */,
+      Exact_sum* local_sum   /* out */,
+      long long  local_n     /* in  */,
+      long long  tile        /* in  */) {
+   acc_t sum = 0.0;
+
+   if (local_sum != NULL) Exact_sum_init(local_sum);
+#  pragma omp parallel reduction(+: sum)
+   {
+      long long first, count, i, len;
+      Exact_sum my_sum;
+
+      Thread_block(local_n, &first, &count);
+      if (local_sum != NULL) Exact_sum_init(&my_sum);
+      for (i = first; i < first + count; i += len) {
+         len = first + count - i < tile ? first + count - i : tile;
+         Kernels.sum(local_x + i, local_y + i, local_z + i, len);
+         if (local_sum != NULL) {
+            // Exact_dot solo normaliza dentro de una llamada
+            Exact_dot(&my_sum, local_x + i, local_y + i, len);
+            Exact_sum_normalize(&my_sum);
+         } else {
+            sum += Kernels.dot(local_x + i, local_y + i, len);
+         }
+         Kernels.scale(local_x + i, scalar, scaled_x + i, len);
+         Kernels.scale(local_y + i, scalar, scaled_y + i, len);
+      }
+      if (local_sum != NULL) {
+#        pragma omp critical
+         Exact_sum_merge(local_sum, &my_sum);
+      }
+   }
+   *local_dot_product = sum;
+}  /* Tiled_vector_ops */
+
+/*-------------------------------------------------------------------
+ * Function:  Tile_size
+ * Purpose:   Choose the elements per tile of Tiled_vector_ops
+ * In args:   requested:  the -t argument; 0 (or "auto") for a size
+ *                        from the L2 of the calling thread's CPU
+ *            in_place:   1 if the scaled vectors overwrite x and y
+ * Ret val:   the tile size
+ *
+ * Note:
+ *    A tile of x, y, z, scaled_x and scaled_y (only x, y and z with
+ *    -i) fills half the L2, which leaves room for the rest of the
+ *    process' data and for conflict misses.  Tiles are a multiple of
+ *    a cache line, so they all start on one.
+ */
+long long Tile_size(
+      long long  requested  /* in */,
+      int        in_place   /* in */) {
+   long long line = ARENA_ALIGN/sizeof(elem_t);
+   long long l2, tile;
+
+   if (requested > 0) return requested;
+   l2 = Cache_size(Current_cpu(), 2);
+   if (l2 <= 0) l2 = DEFAULT_L2;
+   tile = l2/2/((in_place ? 3 : 5)*(long long) sizeof(elem_t));
+   tile -= tile % line;
+   return tile > line ? tile : line;
+}  /* Tile_size */
+
+/*-------------------------------------------------------------------
+ * Function:  Exact_dot_product
+ * Purpose:   Compute the local dot product exactly, independent of the
+ *            number of threads
+ * In args:   local_x: local portion of x
+ *            local_y: local portion of y
+ *            local_n: size of local vectors
+ * Out arg:   local_sum: the exact sum of local_x[i]*local_y[i]
+ *
+ * Note:
+ *    Each thread accumulates its block into a private Exact_sum; the
+ *    merges are exact, so the order the threads reach the critical
+ *    section doesn't matter.
+ */
+void Exact_dot_product(
+      elem_t     local_x[]   /* in  */,
+      elem_t     local_y[]   /* in  */,
+      Exact_sum* local_sum   /* out */,
+      long long  local_n     /* in  */) {
+   Exact_sum_init(local_sum);
+#  pragma omp parallel
+   {
+      long long first, count;
+      Exact_sum my_sum;
+
+      Thread_block(local_n, &first, &count);
+      Exact_sum_init(&my_sum);
+      Exact_dot(&my_sum, local_x + first, local_y + first, count);
+#     pragma omp critical
+      Exact_sum_merge(local_sum, &my_sum);
+   }
+}  /* Exact_dot_product */
+
+/*-------------------------------------------------------------------
+ * Function:  Exact_sum_op
+ * Purpose:   MPI_User_function adding arrays of Exact_sums:
+ *            inout[i] += in[i]
+ * Note:
+ *    Exact, so the op is created commutative and MPI may combine the
+ *    processes' sums in any order.
+ */
+void Exact_sum_op(
+      void*          in      /* in     */,
+      void*          inout   /* in/out */,
+      int*           len_p   /* in     */,
+      MPI_Datatype*  type_p  /* in     */) {
+   Exact_sum* a = in;
+   Exact_sum* b = inout;
+   int i;
+
+   for (i = 0; i < *len_p; i++)
+      Exact_sum_merge(&b[i], &a[i]);
+}  /* Exact_sum_op */
+
+/*-------------------------------------------------------------------
+ * Function:  Evaluate_expression
+ * Purpose:   Run a -e program over the local blocks
+ * In args:   prog_p:   the program
+ *            local_n:  size of local vectors
+ * In/out arg:  vecs:   local vectors, x and y first; the program
+ *                      writes the others (and x and y if it assigns
+ *                      them)
+ * Out arg:   local_results:  this process' partial results of the
+ *                            program's reductions
+ *
+ * Note:
+ *    Each thread runs the program over its Thread_block, and the
+ *    threads' partial results are merged one at a time.
+ */
+void Evaluate_expression(
+      Expr_program*  prog_p         /* in     */,
+      elem_t*        vecs[]         /* in/out */,
+      acc_t          local_results[] /* out   */,
+      long long      local_n        /* in     */) {
+   Expr_start(prog_p, local_results);
+#  pragma omp parallel
+   {
+      long long first, count;
+      acc_t my_results[EXPR_REDS];
+
+      Thread_block(local_n, &first, &count);
+      Expr_start(prog_p, my_results);
+      Expr_run(prog_p, vecs, first, count, my_results);
+#     pragma omp critical
+      Expr_merge(prog_p, local_results, my_results);
+   }
+}  /* Evaluate_expression */
+
+/*-------------------------------------------------------------------
+ * Function:  Expr_reduce_op
+ * Purpose:   MPI_User_function combining arrays of -e partial results:
+ *            each result of inout[i] with the same one of in[i], by
+ *            the kind of its reduction in expr_prog
+ * Note:
+ *    A user function gets no argument for the program, so it reads
+ *    the global expr_prog, the same on every process.  Sums, minima
+ *    and maxima are all commutative.
+ */
+void Expr_reduce_op(
+      void*          in      /* in     */,
+      void*          inout   /* in/out */,
+      int*           len_p   /* in     */,
+      MPI_Datatype*  type_p  /* in     */) {
+   acc_t* a = in;
+   acc_t* b = inout;
+   int i;
+
+   for (i = 0; i < *len_p; i++)
+      Expr_merge(&expr_prog, b + i*expr_prog.red_count,
+            a + i*expr_prog.red_count);
+}  /* Expr_reduce_op */
+
+/*-------------------------------------------------------------------
+ * Function:  Start_dot_reduction
+ * Purpose:   Start summing the local dot products of all processes
+ * In args:   local_dot_product:   this process' partial; must not
+ *               change until the request completes
+ *            type, op:            MPI_ACC and MPI_SUM, the
+ *                                 Exact_sum type and Exact_sum_op,
+ *                                 or the -e results and Expr_reduce_op
+ *            all_ranks:           1 for the sum on every process
+ *                                 (MPI_Iallreduce), 0 for process 0
+ *                                 only (MPI_Ireduce)
+ *            comm:                communicator containing all processes
+ * Out args:  global_dot_product:  the sum, once the request completes
+ *            request_p:           the request to MPI_Wait on
+ */
+void Start_dot_reduction(
+      void*         local_dot_product   /* in  */,
+      void*         global_dot_product  /* out */,
+      MPI_Datatype  type                /* in  */,
+      MPI_Op        op                  /* in  */,
+      int           all_ranks           /* in  */,
+      MPI_Comm      comm                /* in  */,
+      MPI_Request*  request_p           /* out */) {
+   if (all_ranks)
+      MPI_Iallreduce(local_dot_product, global_dot_product, 1, type, op,
+            comm, request_p);
+   else
+      MPI_Ireduce(local_dot_product, global_dot_product, 1, type, op, 0,
+            comm, request_p);
+}  /* Start_dot_reduction */
+
+/*-------------------------------------------------------------------
+ * Function:  Thread_block
+ * Purpose:   Find the part of a local block of n elements handled by
+ *            the calling thread, using the same balanced block
+ *            distribution as the processes
+ * In arg:    n:        number of elements shared by the thread team
+ * Out args:  first_p:  index of the thread's first element
+ *            count_p:  number of elements for the thread
+ */
+void Thread_block(
+      long long   n        /* in  */,
+      long long*  first_p  /* out */,
+      long long*  count_p  /* out */) {
+#  ifdef _OPENMP
+   int my_thread = omp_get_thread_num();
+   int thread_count = omp_get_num_threads();
+#  else
+   int my_thread = 0;
+   int thread_count = 1;
+#  endif
+
+   *first_p = Block_first(n, thread_count, my_thread);
+   *count_p = Block_size(n, thread_count, my_thread);
+}  /* Thread_block */
+
+/*-------------------------------------------------------------------
+ * Function:  Lap_ms
+ * Purpose:   Return the milliseconds elapsed since *start_p and restart
+ *            the lap at the current time
+ * In/out arg:  start_p:  MPI_Wtime() at the start of the lap
+ */
+double Lap_ms(double* start_p /* in/out */) {
+   double now = MPI_Wtime();
+   double ms = (now - *start_p)*1000;
+
+   *start_p = now;
+   return ms;
+}  /* Lap_ms */
+
+/*-------------------------------------------------------------------
+ * Function:  Report_phases
+ * Purpose:   Reduce every process' phase times to their minimum,
+ *            average and maximum and print them on process 0 as one
+ *            JSON line starting with "TIMING "
+ * In args:   phase_ms:  this process' time in each phase (ms)
+ *            n:         order of global vector
+ *            threads:   threads per process
+ *            my_rank:   rank of calling process
+ *            comm:      communicator containing all processes
+ */
+void Report_phases(
+      double     phase_ms[]  /* in */,
+      long long  n           /* in */,
+      int        threads     /* in */,
+      int        my_rank     /* in */,
+      MPI_Comm   comm        /* in */) {
+   double min[PHASE_COUNT], max[PHASE_COUNT], sum[PHASE_COUNT];
+   int comm_sz, p;
+
+   MPI_Comm_size(comm, &comm_sz);
+   MPI_Reduce(phase_ms, min, PHASE_COUNT, MPI_DOUBLE, MPI_MIN, 0, comm);
+   MPI_Reduce(phase_ms, max, PHASE_COUNT, MPI_DOUBLE, MPI_MAX, 0, comm);
+   MPI_Reduce(phase_ms, sum, PHASE_COUNT, MPI_DOUBLE, MPI_SUM, 0, comm);
+
+   if (my_rank == 0) {
+      printf("TIMING {\"program\":\"%s\",\"comm_sz\":%d,\"threads\":%d,"
+            "\"n\":%lld,\"unit\":\"ms\",\"phases\":{", PROGRAM, comm_sz,
+            threads, n);
+      for (p = 0; p < PHASE_COUNT; p++)
+         printf("%s\"%s\":{\"min\":%.3f,\"avg\":%.3f,\"max\":%.3f}",
+               p > 0 ? "," : "", phase_names[p], min[p],
+               sum[p]/comm_sz, max[p]);
+      printf("}}\n");
+   }
+}  /* Report_phases */
@@ -0,0 +1,301 @@
+/* File:     placement.h
+ *
+ * Purpose:  CPU topology discovery, thread pinning and page placement
+ *           queries for the threaded vector programs.  The topology
+ *           (NUMA node, package and core of each CPU) is read from
+ *           /sys/devices/system/cpu, so hwloc isn't needed.
+ *
+ * Usage:    #define _GNU_SOURCE before the first #include of the
+ *           program, #include "placement.h", then:
+ *              count = Get_cpus(cpus);   (before pinning anything)
+ *              cpu = cpus[Choose_cpu(count, slot, slots, policy)].cpu;
+ *              Pin_to_cpu(cpu);          (in each thread)
+ *           Page_nodes reports the NUMA node of a buffer's pages, and
+ *           Cache_size the size of a CPU's L1, L2, ... data cache.
+ *
+ * Notes:
+ * 1.  Setting the environment variable VECTOR_PIN to none, compact or
+ *     spread chooses the policy (default compact).  compact gives
+ *     consecutive slots neighbouring CPUs, filling one core, package
+ *     and node before the next; spread spaces the slots evenly over
+ *     the CPUs, so they are divided between the nodes.  none leaves
+ *     placement to the OS.
+ * 2.  Only the CPUs in the process' affinity mask are used, so a
+ *     binding made by mpiexec is refined, not overridden.
+ * 3.  Placement only works on Linux; elsewhere Get_cpus returns 0,
+ *     nothing is pinned and cache sizes are unknown.
+ */
+#ifndef PLACEMENT_H
+#define PLACEMENT_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __linux__
+#include <sched.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#define PL_LINUX 1
+#define MAX_CPUS CPU_SETSIZE
+#else
+#define MAX_CPUS 1
+#endif
+
+/* Most NUMA nodes counted by Page_nodes */
+#define MAX_NODES 64
+
+typedef struct {
+   int cpu;      /* OS CPU number          */
+   int node;     /* NUMA node              */
+   int package;  /* socket                 */
+   int core;     /* core id in the package */
+} Cpu_info;
+
+enum {PIN_NONE, PIN_COMPACT, PIN_SPREAD};
+
+#ifdef PL_LINUX
+/* Read one integer from a /sys file; -1 if it isn't there */
+static int Read_sys_int(const char* path) {
+   FILE* f = fopen(path, "r");
+   int value = -1;
+
+   if (f != NULL) {
+      if (fscanf(f, "%d", &value) != 1) value = -1;
+      fclose(f);
+   }
+   return value;
+}  /* Read_sys_int */
+
+static int Cmp_cpu(const void* a, const void* b) {
+   const Cpu_info *p = a, *q = b;
+
+   if (p->node != q->node) return p->node - q->node;
+   if (p->package != q->package) return p->package - q->package;
+   if (p->core != q->core) return p->core - q->core;
+   return p->cpu - q->cpu;
+}  /* Cmp_cpu */
+#endif
+
+/*---------------------------------------------------------------------
+ * Function:  Cpu_node
+ * Purpose:   Find the NUMA node of a CPU:  the nodeN link in its /sys
+ *            directory (0 if there is none)
+ */
+static int Cpu_node(int cpu /* in */) {
+   int node = 0;
+#  ifdef PL_LINUX
+   char path[64];
+   DIR* dir;
+   struct dirent* entry;
+
+   snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d", cpu);
+   if ((dir = opendir(path)) == NULL) return 0;
+   while ((entry = readdir(dir)) != NULL)
+      if (strncmp(entry->d_name, "node", 4) == 0
+            && sscanf(entry->d_name + 4, "%d", &node) == 1)
+         break;
+   closedir(dir);
+#  endif
+   return node;
+}  /* Cpu_node */
+
+/*---------------------------------------------------------------------
+ * Function:  Get_cpus
+ * Purpose:   List the CPUs the calling process may run on, ordered by
+ *            NUMA node, package, core and CPU number, so hyperthreads
+ *            of a core and cores of a node are adjacent
+ * Out arg:   cpus:  at least MAX_CPUS entries
+ * Ret val:   the number of CPUs, 0 if unknown
+ */
+static int Get_cpus(Cpu_info cpus[] /* out */) {
+   int count = 0;
+#  ifdef PL_LINUX
+   cpu_set_t mask;
+   char path[96];
+   int cpu;
+
+   if (sched_getaffinity(0, sizeof(mask), &mask) != 0) return 0;
+   for (cpu = 0; cpu < MAX_CPUS; cpu++) {
+      if (!CPU_ISSET(cpu, &mask)) continue;
+      cpus[count].cpu = cpu;
+      cpus[count].node = Cpu_node(cpu);
+      snprintf(path, sizeof(path),
+            "/sys/devices/system/cpu/cpu%d/topology/physical_package_id",
+            cpu);
+      cpus[count].package = Read_sys_int(path);
+      snprintf(path, sizeof(path),
+            "/sys/devices/system/cpu/cpu%d/topology/core_id", cpu);
+      cpus[count].core = Read_sys_int(path);
+      count++;
+   }
+   qsort(cpus, count, sizeof(Cpu_info), Cmp_cpu);
+#  endif
+   return count;
+}  /* Get_cpus */
+
+/*---------------------------------------------------------------------
+ * Function:  Pin_policy
+ * Purpose:   Read the pinning policy from VECTOR_PIN
+ * Ret val:   PIN_NONE, PIN_COMPACT (the default) or PIN_SPREAD
+ */
+static int Pin_policy(void) {
+   const char* s = getenv("VECTOR_PIN");
+
+   if (s == NULL || *s == '\0' || strcmp(s, "compact") == 0)
+      return PIN_COMPACT;
+   if (strcmp(s, "spread") == 0) return PIN_SPREAD;
+   if (strcmp(s, "none") != 0)
+      fprintf(stderr, "VECTOR_PIN=%s unknown, not pinning\n", s);
+   return PIN_NONE;
+}  /* Pin_policy */
+
+/*---------------------------------------------------------------------
+ * Function:  Choose_cpu
+ * Purpose:   Pick the entry of the Get_cpus list for one of slots
+ *            workers (e.g. rank-on-node*threads + thread)
+ * In args:   count:   number of CPUs from Get_cpus
+ *            slot:    the worker, 0 <= slot < slots
+ *            slots:   number of workers sharing the CPUs
+ *            policy:  PIN_COMPACT or PIN_SPREAD
+ * Ret val:   index into the Get_cpus list
+ *
+ * Note:
+ *    With more workers than CPUs the workers wrap around.
+ */
+static int Choose_cpu(
+      int  count   /* in */,
+      int  slot    /* in */,
+      int  slots   /* in */,
+      int  policy  /* in */) {
+   if (slots > count || policy == PIN_COMPACT)
+      return slot % count;
+   return (int) ((long long) slot*count/slots);
+}  /* Choose_cpu */
+
+/*---------------------------------------------------------------------
+ * Function:  Pin_to_cpu
+ * Purpose:   Bind the calling thread to one CPU
+ * Ret val:   0 on success, -1 on failure
+ */
+static int Pin_to_cpu(int cpu /* in */) {
+#  ifdef PL_LINUX
+   cpu_set_t mask;
+
+   CPU_ZERO(&mask);
+   CPU_SET(cpu, &mask);
+   return sched_setaffinity(0, sizeof(mask), &mask);
+#  else
+   return -1;
+#  endif
+}  /* Pin_to_cpu */
+
+/*---------------------------------------------------------------------
+ * Function:  Current_cpu
+ * Purpose:   CPU the calling thread is running on, -1 if unknown
+ */
+static int Current_cpu(void) {
+#  ifdef PL_LINUX
+   return sched_getcpu();
+#  else
+   return -1;
+#  endif
+}  /* Current_cpu */
+
+/*---------------------------------------------------------------------
+ * Function:  Page_nodes
+ * Purpose:   Count the NUMA node of (a sample of) the pages of a
+ *            buffer
+ * In args:   p, bytes:    the buffer
+ *            max_samples: most pages looked at, evenly spaced
+ * Out arg:   counts:      counts[node] pages on node, MAX_NODES
+ *                         entries
+ * Ret val:   number of pages sampled, 0 if unknown
+ *
+ * Note:
+ *    Uses move_pages(2) with no target nodes, which only reports
+ *    where each page is.  Pages that haven't been touched aren't
+ *    counted.
+ */
+static int Page_nodes(
+      void*   p            /* in  */,
+      size_t  bytes        /* in  */,
+      int     max_samples  /* in  */,
+      int     counts[]     /* out */) {
+   int sampled = 0;
+#  ifdef PL_LINUX
+   long page = sysconf(_SC_PAGESIZE);
+   size_t pages = bytes/page, step, i;
+   char* base = (char*) ((size_t) p & ~(size_t) (page - 1));
+   void** addrs;
+   int* status;
+
+   memset(counts, 0, MAX_NODES*sizeof(int));
+   if (pages == 0) return 0;
+   step = pages > (size_t) max_samples ? pages/max_samples : 1;
+   addrs = malloc(max_samples*sizeof(void*));
+   status = malloc(max_samples*sizeof(int));
+   if (addrs == NULL || status == NULL) goto done;
+   for (i = 0; i < pages && sampled < max_samples; i += step)
+      addrs[sampled++] = base + i*page;
+   if (syscall(SYS_move_pages, 0, (unsigned long) sampled, addrs, NULL,
+            status, 0) != 0) {
+      sampled = 0;
+      goto done;
+   }
+   for (i = 0; i < (size_t) sampled; i++)
+      if (status[i] >= 0 && status[i] < MAX_NODES) counts[status[i]]++;
+done:
+   free(addrs);
+   free(status);
+#  else
+   memset(counts, 0, MAX_NODES*sizeof(int));
+#  endif
+   return sampled;
+}  /* Page_nodes */
+
+/*---------------------------------------------------------------------
+ * Function:  Cache_size
+ * Purpose:   Size of the data (or unified) cache of a level seen by a
+ *            CPU, from /sys/devices/system/cpu/cpuN/cache
+ * In args:   cpu:    OS CPU number (-1 for CPU 0)
+ *            level:  1, 2, 3, ...
+ * Ret val:   the size in bytes, 0 if unknown
+ */
+static long long Cache_size(int cpu /* in */, int level /* in */) {
+   long long bytes = 0;
+#  ifdef PL_LINUX
+   char path[128], type[32], unit;
+   long long size;
+   int index, found;
+   FILE* f;
+
+   if (cpu < 0) cpu = 0;
+   for (index = 0; bytes == 0; index++) {
+      snprintf(path, sizeof(path),
+            "/sys/devices/system/cpu/cpu%d/cache/index%d/level", cpu, index);
+      found = Read_sys_int(path);
+      if (found < 0) break;
+      if (found != level) continue;
+      snprintf(path, sizeof(path),
+            "/sys/devices/system/cpu/cpu%d/cache/index%d/type", cpu, index);
+      if ((f = fopen(path, "r")) == NULL) continue;
+      if (fscanf(f, "%31s", type) != 1) type[0] = '\0';
+      fclose(f);
+      if (strcmp(type, "Instruction") == 0) continue;
+      // El tamaño viene como "2048K" o "1M"
+      snprintf(path, sizeof(path),
+            "/sys/devices/system/cpu/cpu%d/cache/index%d/size", cpu, index);
+      if ((f = fopen(path, "r")) == NULL) continue;
+      unit = ' ';
+      if (fscanf(f, "%lld%c", &size, &unit) >= 1)
+         bytes = unit == 'K' ? size << 10 : unit == 'M' ? size << 20
+            : unit == 'G' ? size << 30 : size;
+      fclose(f);
+   }
+#  endif
+   return bytes;
+}  /* Cache_size */
+
+#endif
@@ -1,54 +1,269 @@
 #!/bin/bash
+#
+# Benchmark de escalabilidad (strong y weak scaling) de los programas
+# de suma de vectores.
+#
+# Uso:      ./speedup.sh
+#
+# Todo se configura con variables de entorno, por ejemplo:
+#
+#   RANKS="1 2 4 8" THREADS="1 2" SIZES="10000000 100000000" \
+#   PAR_CMD='./mpi_vector_add3 {n} 2 {t}' MODE=both ./speedup.sh
+#
+# Para medir el costo del producto punto reproducible se corre dos veces,
+# con PAR_CMD='./mpi_vector_add3 {n} 2 {t}' y con
+# PAR_CMD='./mpi_vector_add3 -r {n} 2 {t}'; la fase "dot" de la línea
+# TIMING da solo el producto punto.
+#
+# Con SERVICE=1 (solo mpi_vector_add2) cada punto paralelo arranca el
+# programa una vez como servicio (-S) y le manda cada ejecución como un
+# trabajo por un FIFO, así que el tiempo de mpirun, MPI_Init y la
+# reserva de memoria no se repite en cada medición:
+#
+#   SERVICE=1 PAR_CMD='./mpi_vector_add2 {n} 1' ./speedup.sh
+#
+# Un servicio reusa los vectores, así que sus páginas ya están
+# asignadas y la fase compute no paga fallos de página; la referencia
+# secuencial es entonces el mismo servicio con un proceso y un hilo, no
+# SEC_CMD.
+#
+# Para cada punto (modo, n, procesos, hilos) se hacen WARMUP
+# ejecuciones que se descartan y RUNS ejecuciones medidas.  Se toma el
+# tiempo de las fases PHASE de la línea TIMING (el máximo entre los
+# procesos, que es el que limita) y se reporta mediana, mínimo, máximo,
+# media, desviación estándar e intervalo de confianza del 95% de la
+# media.  El speedup y la eficiencia se calculan contra la mediana del
+# programa secuencial con el mismo n total.
+#
+# PHASE es una fase o una suma de fases, p. ej. PHASE=compute+dot para
+# mpi_vector_add3 sin -f.  Por omisión es compute, el mismo trabajo en
+# todos los programas (vector_add2 lo mide con clock(), que en un solo
+# hilo es igual al tiempo de pared).  PHASE=took usa la línea "Took X ms", pero no es
+# comparable entre programas:  en vector_add2 es tiempo de CPU (clock())
+# de la reserva, la inicialización con rand() y la suma; en los
+# programas MPI es tiempo de pared con otro generador, y con SERVICE=1
+# ya no incluye la reserva.  Con took el speedup y la eficiencia no
+# tienen sentido (pueden salir mayores que 1 con un proceso).
+#
+# En strong scaling n es el tamaño total; en weak scaling n es el
+# tamaño por trabajador (procesos x hilos), así que el n total crece
+# con el número de trabajadores.
+#
+# Resultados (no se borran) en OUT_DIR:
+#   raw.csv       cada ejecución medida
+#   summary.csv   estadísticas por punto
+#   summary.json  lo mismo en JSON
 
-# Número de mediciones
-N=10
+# Número de mediciones y de ejecuciones de calentamiento
+RUNS=${RUNS:-10}
+WARMUP=${WARMUP:-2}
 
-# Programas a medir
-SEC_PROG="./vector_add2"  # Programa secuencial
-PAR_PROG="./mpi_vector_add2"  # Programa paralelo (supongamos MPI)
+# Puntos a medir
+RANKS=${RANKS:-"1 2 4"}
+THREADS=${THREADS:-"1"}
+SIZES=${SIZES:-"100000000"}
+MODE=${MODE:-strong}              # strong, weak o both
 
-# Cantidad de elementos (deberías ajustar este valor para obtener tiempos de ~5 segundos)
-ELEMENTS=100000000
+# Comandos: {n} = tamaño total, {p} = procesos, {t} = hilos
+SEC_CMD=${SEC_CMD:-"./vector_add2 {n}"}
+PAR_CMD=${PAR_CMD:-"./mpi_vector_add2 {n} 1"}
+MPIRUN=${MPIRUN:-"mpirun -np {p}"}
+SERVICE=${SERVICE:-0}             # 1: un servicio por punto paralelo
+PHASE=${PHASE:-compute}           # fases de TIMING sumadas, o took
 
-# Archivos temporales para almacenar tiempos
-SEC_TIMES_FILE="sec_times.txt"
-PAR_TIMES_FILE="par_times.txt"
+OUT_DIR=${OUT_DIR:-"results/$(date +%Y%m%d-%H%M%S)"}
 
-# Inicializar los archivos de tiempo
-> $SEC_TIMES_FILE
-> $PAR_TIMES_FILE
+mkdir -p "$OUT_DIR" || exit 1
+RAW="$OUT_DIR/raw.csv"
+SUMMARY="$OUT_DIR/summary.csv"
+JSON="$OUT_DIR/summary.json"
 
-# Medir el tiempo del programa secuencial
-echo "Midiendo tiempos para el programa secuencial..."
-for i in $(seq 1 $N); do
-    echo "Ejecución secuencial $i..."
-    TIME=$( $SEC_PROG $ELEMENTS | grep 'Took' | awk '{print $2}' )
-    echo $TIME >> $SEC_TIMES_FILE
-done
+echo "mode,program,n,ranks,threads,run,time_ms" > "$RAW"
+echo "mode,program,n,ranks,threads,runs,median_ms,min_ms,max_ms,mean_ms,stddev_ms,ci95_ms,speedup,efficiency" > "$SUMMARY"
 
-# Medir el tiempo del programa paralelo
-echo "Midiendo tiempos para el programa paralelo..."
-for i in $(seq 1 $N); do
-    echo "Ejecución paralela $i..."
-    TIME=$( mpirun -np 4 $PAR_PROG $ELEMENTS | grep 'Took' | awk '{print $2}' )
-    echo $TIME >> $PAR_TIMES_FILE
-done
+# Sustituye {n}, {p} y {t} en un comando
+expand() {
+   local cmd=$1
+   cmd=${cmd//\{n\}/$2}
+   cmd=${cmd//\{p\}/$3}
+   cmd=${cmd//\{t\}/$4}
+   echo "$cmd"
+}
+
+# Tiempo medido de la salida de un programa en stdin:  la suma de los
+# máximos de las fases PHASE de la línea TIMING, o el de "Took"
+phase_time() {
+   awk -v phase="$PHASE" '
+      phase == "took" && /^Took/ { print $2; exit }
+      phase != "took" && /^TIMING / {
+         n = split(phase, names, "+")
+         total = 0
+         for (i = 1; i <= n; i++) {
+            at = index($0, "\"" names[i] "\":{")
+            if (at == 0 || !match(substr($0, at), /"max":[0-9.]+/)) exit
+            total += substr($0, at + RSTART + 5, RLENGTH - 6)
+         }
+         printf "%.3f\n", total
+         exit
+      }'
+}
+
+# Ejecuta un comando y devuelve su tiempo (ver phase_time); con un
+# servicio corriendo el comando son solo los argumentos del trabajo
+run_once() {
+   if [ -n "$SERVICE_FIFO" ]; then
+      echo "$REPLY_FIFO $1" > "$SERVICE_FIFO"
+      phase_time < "$REPLY_FIFO"
+   else
+      OMP_NUM_THREADS=$2 $1 2>/dev/null | phase_time
+   fi
+}
+
+# Arranca el servicio para un punto: start_service <mpirun> <programa> <hilos>
+start_service() {
+   SERVICE_FIFO="$OUT_DIR/jobs.fifo"
+   REPLY_FIFO="$OUT_DIR/reply.fifo"
+   rm -f "$SERVICE_FIFO" "$REPLY_FIFO"
+   mkfifo "$SERVICE_FIFO" "$REPLY_FIFO" || exit 1
+   OMP_NUM_THREADS=$3 $1 $2 -S "$SERVICE_FIFO" > /dev/null 2>&1 &
+   SERVICE_PID=$!
+}
+
+# Detiene el servicio y espera a que termine
+stop_service() {
+   echo quit > "$SERVICE_FIFO"
+   wait $SERVICE_PID
+   rm -f "$SERVICE_FIFO" "$REPLY_FIFO"
+   SERVICE_FIFO=""
+}
 
-# Calcular el promedio del tiempo secuencial
-SEC_AVG=$(awk '{ sum += $1; n++ } END { if (n > 0) print sum / n; }' $SEC_TIMES_FILE)
-echo "Promedio de tiempo secuencial: $SEC_AVG ms"
+# Estadísticas de los tiempos (uno por línea) en stdin:
+# runs median min max mean stddev ci95
+stats() {
+   sort -g | awk '
+      { v[NR] = $1; sum += $1 }
+      END {
+         if (NR == 0) { print "0 NaN NaN NaN NaN NaN NaN"; exit }
+         mean = sum / NR
+         for (i = 1; i <= NR; i++) ss += (v[i] - mean)^2
+         sd = NR > 1 ? sqrt(ss / (NR - 1)) : 0
+         med = NR % 2 ? v[(NR + 1) / 2] : (v[NR / 2] + v[NR / 2 + 1]) / 2
+         # t de Student al 97.5% para NR-1 grados de libertad
+         split("12.706 4.303 3.182 2.776 2.571 2.447 2.365 2.306 2.262 " \
+               "2.228 2.201 2.179 2.160 2.145 2.131 2.120 2.110 2.101 " \
+               "2.093 2.086 2.080 2.074 2.069 2.064 2.060 2.056 2.052 " \
+               "2.048 2.045 2.042", t, " ")
+         df = NR - 1
+         tv = df < 1 ? 0 : (df <= 30 ? t[df] : 1.96)
+         printf "%d %.3f %.3f %.3f %.3f %.3f %.3f\n", NR, med, v[1],
+            v[NR], mean, sd, tv * sd / sqrt(NR)
+      }'
+}
 
-# Calcular el promedio del tiempo paralelo
-PAR_AVG=$(awk '{ sum += $1; n++ } END { if (n > 0) print sum / n; }' $PAR_TIMES_FILE)
-echo "Promedio de tiempo paralelo: $PAR_AVG ms"
+# Mide un punto y agrega una fila a raw.csv y summary.csv
+# measure <modo> <programa> <comando> <n> <procesos> <hilos> <t_base>
+measure() {
+   local mode=$1 prog=$2 cmd=$3 n=$4 p=$5 t=$6 base=$7
+   local i time times=""
+
+   echo "[$mode] $prog n=$n procesos=$p hilos=$t" >&2
+   for i in $(seq 1 $WARMUP); do
+      run_once "$cmd" "$t" > /dev/null
+   done
+   for i in $(seq 1 $RUNS); do
+      time=$(run_once "$cmd" "$t")
+      if [ -z "$time" ]; then
+         echo "  Error: la ejecución $i no imprimió el tiempo de $PHASE" >&2
+         continue
+      fi
+      echo "$mode,$prog,$n,$p,$t,$i,$time" >> "$RAW"
+      times="$times$time"$'\n'
+   done
+
+   read runs med min max mean sd ci <<< "$(printf "%s" "$times" | stats)"
+   # Eficiencia: strong = speedup / trabajadores; weak = t_base / t_par,
+   # con t_base el secuencial con el n por trabajador
+   awk -v mode="$mode" -v prog="$prog" -v n="$n" -v p="$p" -v t="$t" \
+       -v runs="$runs" -v med="$med" -v min="$min" -v max="$max" \
+       -v mean="$mean" -v sd="$sd" -v ci="$ci" -v base="$base" '
+      BEGIN {
+         w = p * t
+         if (base == "" || med + 0 == 0) { s = "NaN"; e = "NaN" }
+         else if (mode == "weak") { e = base / med; s = e * w }
+         else { s = base / med; e = s / w }
+         if (s != "NaN") { s = sprintf("%.4f", s); e = sprintf("%.4f", e) }
+         printf "%s,%s,%s,%s,%s,%s,%s,%s,%s,%s,%s,%s,%s,%s\n", mode, prog,
+            n, p, t, runs, med, min, max, mean, sd, ci, s, e
+      }' >> "$SUMMARY"
+   echo "  mediana $med ms (IC95 +/- $ci ms)" >&2
+   echo "$med"
+}
+
+# Tiempo secuencial de referencia para un n total (se mide una vez)
+declare -A SEC_MEDIAN
+baseline() {
+   local n=$1 cmd
+   if [ -z "${SEC_MEDIAN[$n]}" ]; then
+      if [ "$SERVICE" = 1 ]; then
+         start_service "$(expand "$MPIRUN" $n 1 1)" "${PAR_CMD%% *}" 1
+         cmd=$(expand "$PAR_CMD" $n 1 1)
+         SEC_MEDIAN[$n]=$(measure seq "${PAR_CMD%% *}" "${cmd#* }" $n 1 1 "")
+         stop_service
+      else
+         SEC_MEDIAN[$n]=$(measure seq "${SEC_CMD%% *}" "$(expand "$SEC_CMD" $n 1 1)" $n 1 1 "")
+      fi
+   fi
+}
+
+case $MODE in
+   both) MODES="strong weak";;
+   strong|weak) MODES=$MODE;;
+   *) echo "Error: MODE debe ser strong, weak o both" >&2; exit 1;;
+esac
+
+for mode in $MODES; do
+   for size in $SIZES; do
+      # En weak scaling la referencia es el secuencial con n = size
+      if [ "$mode" = weak ]; then baseline $size; fi
+      for p in $RANKS; do
+         for t in $THREADS; do
+            if [ "$mode" = weak ]; then
+               n=$((size * p * t))
+               base=${SEC_MEDIAN[$size]}
+            else
+               n=$size
+               baseline $n
+               base=${SEC_MEDIAN[$n]}
+            fi
+            cmd="$(expand "$MPIRUN" $n $p $t) $(expand "$PAR_CMD" $n $p $t)"
+            if [ "$SERVICE" = 1 ]; then
+               start_service "$(expand "$MPIRUN" $n $p $t)" \
+                  "${PAR_CMD%% *}" $t
+               cmd=$(expand "$PAR_CMD" $n $p $t)
+               cmd=${cmd#* }
+            fi
+            measure $mode "${PAR_CMD%% *}" "$cmd" $n $p $t "$base" > /dev/null
+            if [ "$SERVICE" = 1 ]; then stop_service; fi
+         done
+      done
+   done
+done
 
-# Calcular el speedup
-if [ "$PAR_AVG" != "0" ]; then
-    SPEEDUP=$(echo "$SEC_AVG / $PAR_AVG" | bc -l)
-    echo "Speedup logrado: $SPEEDUP"
-else
-    echo "Error: El tiempo paralelo es cero, no se puede calcular el speedup"
-fi
+# summary.csv -> summary.json
+awk -F, '
+   NR == 1 { for (i = 1; i <= NF; i++) key[i] = $i; next }
+   {
+      printf "%s  {", (NR > 2 ? ",\n" : "[\n")
+      for (i = 1; i <= NF; i++) {
+         q = (i <= 2) ? "\"" : ""
+         v = ($i == "NaN") ? "null" : q $i q
+         printf "%s\"%s\": %s", (i > 1 ? ", " : ""), key[i], v
+      }
+      printf "}"
+   }
+   END { print (NR > 1 ? "\n]" : "[]") }' "$SUMMARY" > "$JSON"
 
-# Limpiar archivos temporales
-rm $SEC_TIMES_FILE $PAR_TIMES_FILE
\ No newline at end of file
+echo
+column -s, -t "$SUMMARY" 2>/dev/null || cat "$SUMMARY"
+echo
+echo "Resultados en $OUT_DIR"
@@ -2,37 +2,145 @@
  *
  * Purpose:  Implement vector addition
  *
- * Compile:  gcc -g -Wall -o vector_add vector_add.c
+ * Compile:  gcc -g -Wall -O2 -fopenmp -o vector_add vector_add.c
  * Run:      ./vector_add
+ *           ./vector_add <x file> <y file> <z file>
  *
- * Input:    The order of the vectors, n, and the vectors x and y
- * Output:   The sum vector z = x+y
+ * Input:    The order of the vectors, n, and the vectors x and y, as
+ *           text on stdin, or as binary vector files
+ * Output:   The sum vector z = x+y, as text on stdout or as a binary
+ *           vector file
+ *
+ * Binary vector files have a VEC_HEADER_SIZE byte header (magic,
+ * element count, element type and size, see vector_file.h) followed
+ * by the elements in native byte order.  x and y are mapped read-only and
+ * z is created and mapped, so the addition works directly on the file
+ * pages with no parsing or copies.  Text is still the default and is
+ * meant for debugging and small inputs.
+ *
+ * Text input is whitespace or comma separated.  After n, stdin is
+ * read to EOF in one go; each vector is then split into one chunk per
+ * OpenMP thread at separator boundaries and the chunks are parsed in
+ * parallel (see Parse_double).  The sum is printed with the shortest
+ * representation that reads back as the same double (see
+ * Format_double), formatted in parallel into per-thread buffers that
+ * are written with large fwrites.  Use OMP_NUM_THREADS to set the
+ * number of threads.
+ *
+ * Compiled with -DVEC_FLOAT or -DVEC_MIXED the vectors are floats (see
+ * vector_type.h):  text is parsed and printed with Parse_float and
+ * Format_float, and only float vector files are accepted.
  *
  * Note:
- *    If the program detects an error (order of vector <= 0 or malloc
- * failure), it prints a message and terminates
+ *    If the program detects an error (order of vector <= 0, malloc
+ * failure, or a bad or mismatched vector file), it prints a message
+ * and terminates.  The addition uses the SIMD kernels in
+ * vector_kernels.h (see VECTOR_KERNELS there).
  *
  * IPP:      Section 3.4.6 (p. 109)
  */
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <float.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "vector_kernels.h"
+#include "vector_file.h"
+#include "vector_type.h"
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+/* Elements formatted by each thread per round in Print_vector, and
+ * the longest text Format_double produces ("%.17g" of a double) */
+#define FORMAT_CHUNK 65536
+#define MAX_DOUBLE_TEXT 32
+
+/* x87 80-bit long doubles: exact 64-bit mantissas, used by
+ * Decimal_to_double and Format_digits */
+#if (defined(__x86_64__) || defined(__i386__)) && LDBL_MANT_DIG == 64
+#define HAVE_X87_LONG_DOUBLE 1
+#endif
 
-void Read_n(int* n_p);
-void Allocate_vectors(double** x_pp, double** y_pp, double** z_pp, int n);
-void Read_vector(double a[], int n, char vec_name[]);
-void Print_vector(double b[], int n, char title[]);
-void Vector_sum(double x[], double y[], double z[], int n);
+/* Exact powers of ten: 10^22 is the largest exact double, 10^27 the
+ * largest exact x87 long double */
+static const double pow10_tab[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6,
+   1e7, 1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18,
+   1e19, 1e20, 1e21, 1e22};
+#ifdef HAVE_X87_LONG_DOUBLE
+static const long double pow10l_tab[] = {1e0L, 1e1L, 1e2L, 1e3L, 1e4L,
+   1e5L, 1e6L, 1e7L, 1e8L, 1e9L, 1e10L, 1e11L, 1e12L, 1e13L, 1e14L, 1e15L,
+   1e16L, 1e17L, 1e18L, 1e19L, 1e20L, 1e21L, 1e22L, 1e23L, 1e24L, 1e25L,
+   1e26L, 1e27L};
+#endif
+
+/* Text read from stdin after n, and how much of it has been parsed */
+typedef struct {
+   char*   buf;   /* NUL terminated */
+   size_t  len;
+   size_t  pos;
+} Text_input;
+
+void Read_n(long long* n_p);
+void Allocate_vectors(elem_t** x_pp, elem_t** y_pp, elem_t** z_pp,
+      long long n);
+void Read_vector(elem_t a[], long long n, char vec_name[],
+      Text_input* in_p);
+void Read_text(Text_input* in_p);
+int Parse_double(char s[], char** end_p, double* x_p);
+int Format_double(double x, char out[]);
+#if ELEM_IS_FLOAT
+int Parse_float(char s[], char** end_p, float* x_p);
+int Format_float(float x, char out[]);
+#define Parse_elem Parse_float
+#define Format_elem Format_float
+#else
+#define Parse_elem Parse_double
+#define Format_elem Format_double
+#endif
+int Thread_count(void);
+void Print_vector(elem_t b[], long long n, char title[]);
+void Vector_sum(elem_t x[], elem_t y[], elem_t z[], long long n);
+elem_t* Map_vector(char path[], long long* n_p);
+elem_t* Create_vector_file(char path[], long long n);
+void Unmap_vector(elem_t a[], long long n);
 
 /*---------------------------------------------------------------------*/
-int main(void) {
-   int n;
-   double *x, *y, *z;
+int main(int argc, char* argv[]) {
+   long long n, y_n;
+   elem_t *x, *y, *z;
+   Text_input in = {NULL, 0, 0};
+
+   Select_kernels();
+   if (argc == 4) {
+      x = Map_vector(argv[1], &n);
+      y = Map_vector(argv[2], &y_n);
+      if (y_n != n) {
+         fprintf(stderr, "%s has %lld elements, %s has %lld\n",
+               argv[1], n, argv[2], y_n);
+         exit(-1);
+      }
+      z = Create_vector_file(argv[3], n);
+
+      Vector_sum(x, y, z, n);
+
+      Unmap_vector(x, n);
+      Unmap_vector(y, n);
+      Unmap_vector(z, n);
+      return 0;
+   } else if (argc != 1) {
+      fprintf(stderr, "usage: %s [<x file> <y file> <z file>]\n", argv[0]);
+      exit(-1);
+   }
 
    Read_n(&n);
    Allocate_vectors(&x, &y, &z, n);
    
-   Read_vector(x, n, "x");
-   Read_vector(y, n, "y");
+   Read_vector(x, n, "x", &in);
+   Read_vector(y, n, "y", &in);
    
    Vector_sum(x, y, z, n);
 
@@ -41,6 +149,7 @@ int main(void) {
    free(x);
    free(y);
    free(z);
+   free(in.buf);
 
    return 0;
 }  /* main */
@@ -52,9 +161,9 @@ int main(void) {
  *
  * Errors:    If n <= 0, the program terminates
  */
-void Read_n(int* n_p /* out */) {
+void Read_n(long long* n_p /* out */) {
    printf("What's the order of the vectors?\n");
-   scanf("%d", n_p);
+   scanf("%lld", n_p);
    if (*n_p <= 0) {
       fprintf(stderr, "Order should be positive\n");
       exit(-1);
@@ -70,35 +179,448 @@ void Read_n(int* n_p /* out */) {
  * Errors:    If one of the mallocs fails, the program terminates
  */
 void Allocate_vectors(
-      double**  x_pp  /* out */, 
-      double**  y_pp  /* out */, 
-      double**  z_pp  /* out */, 
-      int       n     /* in  */) {
-   *x_pp = malloc(n*sizeof(double));
-   *y_pp = malloc(n*sizeof(double));
-   *z_pp = malloc(n*sizeof(double));
+      elem_t**  x_pp  /* out */, 
+      elem_t**  y_pp  /* out */, 
+      elem_t**  z_pp  /* out */, 
+      long long n     /* in  */) {
+   *x_pp = malloc((size_t) n*sizeof(elem_t));
+   *y_pp = malloc((size_t) n*sizeof(elem_t));
+   *z_pp = malloc((size_t) n*sizeof(elem_t));
    if (*x_pp == NULL || *y_pp == NULL || *z_pp == NULL) {
       fprintf(stderr, "Can't allocate vectors\n");
       exit(-1);
    }
 }  /* Allocate_vectors */
 
+/* Separators between numbers in text input */
+static int Is_sep(char c) {
+   return c == ' ' || c == '\n' || c == '\t' || c == '\r' || c == ','
+      || c == '\v' || c == '\f';
+}  /* Is_sep */
+
 /*---------------------------------------------------------------------
  * Function:  Read_vector
- * Purpose:   Read a vector from stdin
+ * Purpose:   Read the next n numbers of the text on stdin into a
  * In args:   n:  order of the vector
  *            vec_name:  name of vector (e.g., x)
+ * In/out arg:  in_p:  the text read from stdin; read on the first
+ *               call, and advanced past the numbers parsed
  * Out arg:   a:  the vector to be read in
+ *
+ * Errors:    If there are fewer than n numbers left, or one of them
+ *            isn't a number, the program terminates
+ *
+ * Note:
+ *    The remaining text is split into one chunk per thread, each
+ *    starting at a separator.  Each thread counts the numbers in its
+ *    chunk, a prefix sum of the counts gives the index of each chunk's
+ *    first number, and then each thread parses its chunk directly
+ *    into a.
  */
 void Read_vector(
-      double  a[]         /* out */, 
-      int     n           /* in  */, 
-      char    vec_name[]  /* in  */) {
-   int i;
+      elem_t      a[]         /* out    */,
+      long long   n           /* in     */,
+      char        vec_name[]  /* in     */,
+      Text_input* in_p        /* in/out */) {
+   int thread_count = Thread_count(), t, ok = 1;
+   size_t* starts;
+   long long* firsts;
+   char* text;
+
    printf("Enter the vector %s\n", vec_name);
-   for (i = 0; i < n; i++)
-      scanf("%lf", &a[i]);
-}  /* Read_vector */  
+   fflush(stdout);
+   if (in_p->buf == NULL) Read_text(in_p);
+   text = in_p->buf;
+
+   starts = malloc((thread_count + 1)*sizeof(size_t));
+   firsts = malloc((thread_count + 1)*sizeof(long long));
+   if (starts == NULL || firsts == NULL) {
+      fprintf(stderr, "Can't allocate chunks\n");
+      exit(-1);
+   }
+   starts[0] = in_p->pos;
+   starts[thread_count] = in_p->len;
+   for (t = 1; t < thread_count; t++) {
+      size_t s = in_p->pos + (in_p->len - in_p->pos)/thread_count*t;
+      if (s < starts[t-1]) s = starts[t-1];
+      while (s < in_p->len && !Is_sep(text[s])) s++;
+      starts[t] = s;
+   }
+
+   /* Count the numbers in each chunk */
+#  pragma omp parallel for num_threads(thread_count) schedule(static, 1)
+   for (t = 0; t < thread_count; t++) {
+      size_t i;
+      long long count = 0;
+
+      for (i = starts[t]; i < starts[t+1]; i++)
+         if (!Is_sep(text[i]) && (i == starts[t] || Is_sep(text[i-1])))
+            count++;
+      firsts[t+1] = count;
+   }
+   firsts[0] = 0;
+   for (t = 0; t < thread_count; t++)
+      firsts[t+1] += firsts[t];
+   if (firsts[thread_count] < n) {
+      fprintf(stderr, "Expected %lld numbers for %s, found %lld\n",
+            n, vec_name, firsts[thread_count]);
+      exit(-1);
+   }
+
+   /* Parse them, stopping after the n-th */
+#  pragma omp parallel for num_threads(thread_count) schedule(static, 1) \
+      reduction(&&: ok)
+   for (t = 0; t < thread_count; t++) {
+      size_t i = starts[t];
+      long long k;
+      char* end;
+
+      for (k = firsts[t]; k < n && k < firsts[t+1]; k++) {
+         while (Is_sep(text[i])) i++;
+         if (!Parse_elem(text + i, &end, &a[k])) {
+            ok = 0;
+            break;
+         }
+         i = end - text;
+         if (k == n - 1) in_p->pos = i;
+      }
+   }
+   if (!ok) {
+      fprintf(stderr, "Bad number in %s\n", vec_name);
+      exit(-1);
+   }
+
+   free(starts);
+   free(firsts);
+}  /* Read_vector */
+
+/*---------------------------------------------------------------------
+ * Function:  Read_text
+ * Purpose:   Read the rest of stdin into memory
+ * Out arg:   in_p:  the text, NUL terminated, with pos = 0
+ *
+ * Errors:    If the buffer can't be allocated, the program terminates
+ */
+void Read_text(Text_input* in_p /* out */) {
+   size_t cap = 1 << 20, got;
+   char* buf = malloc(cap + 1);
+
+   in_p->len = in_p->pos = 0;
+   while (buf != NULL
+         && (got = fread(buf + in_p->len, 1, cap - in_p->len, stdin)) > 0) {
+      in_p->len += got;
+      if (in_p->len == cap) {
+         cap *= 2;
+         buf = realloc(buf, cap + 1);
+      }
+   }
+   if (buf == NULL) {
+      fprintf(stderr, "Can't allocate input buffer\n");
+      exit(-1);
+   }
+   buf[in_p->len] = '\0';
+   in_p->buf = buf;
+}  /* Read_text */
+
+/*---------------------------------------------------------------------
+ * Function:  Decimal_to_double
+ * Purpose:   Convert m*10^e10 to the nearest double, when that can be
+ *            done exactly without strtod
+ * In args:   m, e10:  the decimal
+ *            neg:     1 for -m*10^e10
+ * Out arg:   x_p:     the double
+ * Ret val:   1 if *x_p is the correctly rounded value, 0 if the
+ *            caller should use strtod instead
+ *
+ * Note:
+ *    A mantissa of at most 2^53 times or over an exact power of ten
+ *    of at most 10^22 is a single correctly rounded double operation
+ *    (Clinger's fast path).  With x87 long doubles, 64-bit mantissas
+ *    and powers up to 10^27 are also exact, and the one long double
+ *    rounding can only change the final double rounding if the 11
+ *    bits below the double's mantissa are within one of the halfway
+ *    point; those cases are rejected.
+ */
+static int Decimal_to_double(
+      unsigned long long  m     /* in  */,
+      int                 e10   /* in  */,
+      int                 neg   /* in  */,
+      double*             x_p   /* out */) {
+   double x;
+#  ifdef HAVE_X87_LONG_DOUBLE
+   long double r;
+   unsigned long long bits;
+#  endif
+
+   if (m == 0) {
+      x = 0.0;
+   } else if (m <= 1ULL << 53 && e10 >= -22 && e10 <= 22) {
+      x = e10 < 0 ? (double) m / pow10_tab[-e10] : (double) m * pow10_tab[e10];
+#  ifdef HAVE_X87_LONG_DOUBLE
+   } else if (e10 >= -27 && e10 <= 27) {
+      r = e10 < 0 ? (long double) m / pow10l_tab[-e10]
+         : (long double) m * pow10l_tab[e10];
+      memcpy(&bits, &r, sizeof(bits));
+      if ((bits & 0x7FF) >= 0x3FF && (bits & 0x7FF) <= 0x401) return 0;
+      x = (double) r;
+#  endif
+   } else {
+      return 0;
+   }
+   *x_p = neg ? -x : x;
+   return 1;
+}  /* Decimal_to_double */
+
+/*---------------------------------------------------------------------
+ * Function:  Parse_double
+ * Purpose:   Parse the number starting at s
+ * In arg:    s:      the number, followed by a separator or '\0'
+ * Out args:  end_p:  the first character after the number
+ *            x_p:    the number
+ * Ret val:   1 if s starts with a number followed by a separator,
+ *            0 otherwise
+ *
+ * Note:
+ *    Plain decimals with at most 19 significant digits are converted
+ *    by Decimal_to_double.  Everything else (longer mantissas, large
+ *    exponents, inf, nan, hex), and the rare cases Decimal_to_double
+ *    can't round exactly, go to strtod.
+ */
+int Parse_double(
+      char     s[]    /* in  */,
+      char**   end_p  /* out */,
+      double*  x_p    /* out */) {
+   char* p = s;
+   unsigned long long m = 0;
+   int neg = 0, digits = 0, sig = 0, frac = 0, in_frac = 0;
+   int e = 0, e_neg = 0;
+
+   if (*p == '-' || *p == '+') neg = *p++ == '-';
+   for (;; p++) {
+      if (*p == '.' && !in_frac) {
+         in_frac = 1;
+         continue;
+      }
+      if (*p < '0' || *p > '9') break;
+      digits++;
+      if (in_frac) frac++;
+      if (m == 0 && *p == '0') continue;
+      if (++sig > 19) goto slow;
+      m = 10*m + (*p - '0');
+   }
+   if (digits == 0) goto slow;
+   if (*p == 'e' || *p == 'E') {
+      p++;
+      if (*p == '-' || *p == '+') e_neg = *p++ == '-';
+      if (*p < '0' || *p > '9') goto slow;
+      for (; *p >= '0' && *p <= '9'; p++)
+         if ((e = 10*e + (*p - '0')) > 9999) goto slow;
+   }
+   if (*p != '\0' && !Is_sep(*p)) goto slow;
+   if (!Decimal_to_double(m, (e_neg ? -e : e) - frac, neg, x_p))
+      goto slow;
+   *end_p = p;
+   return 1;
+
+slow:
+   *x_p = strtod(s, end_p);
+   return *end_p != s && (**end_p == '\0' || Is_sep(**end_p));
+}  /* Parse_double */
+
+#if ELEM_IS_FLOAT
+/*---------------------------------------------------------------------
+ * Function:  Parse_float
+ * Purpose:   Parse the number starting at s into a float
+ * In arg:    s:      the number, followed by a separator or '\0'
+ * Out args:  end_p:  the first character after the number
+ *            x_p:    the number
+ * Ret val:   1 if s starts with a number followed by a separator,
+ *            0 otherwise
+ *
+ * Note:
+ *    The number is parsed by Parse_double and the double rounded to
+ *    float.  That second rounding can only differ from rounding the
+ *    decimal directly when the double is exactly halfway between two
+ *    floats (the 29 bits below a float's mantissa are 1000...0) or
+ *    in the float subnormal range; those go to strtof.
+ */
+int Parse_float(
+      char    s[]    /* in  */,
+      char**  end_p  /* out */,
+      float*  x_p    /* out */) {
+   double x;
+   uint64_t bits;
+
+   if (!Parse_double(s, end_p, &x)) return 0;
+   memcpy(&bits, &x, sizeof(bits));
+   if ((bits & 0x1FFFFFFFULL) == 0x10000000ULL
+         || (x != 0 && x > -FLT_MIN && x < FLT_MIN))
+      *x_p = strtof(s, NULL);
+   else
+      *x_p = (float) x;
+   return 1;
+}  /* Parse_float */
+#endif
+
+/*---------------------------------------------------------------------
+ * Function:  Format_digits
+ * Purpose:   Write x (finite, nonzero) with at most prec significant
+ *            digits, if that text reads back as x
+ * In args:   x:     the number
+ *            prec:  number of significant digits, at most 17
+ * Out arg:   out:   the text, NUL terminated
+ * Ret val:   The length of the text, 0 if it doesn't round-trip, or
+ *            -1 if that can't be decided without snprintf and strtod
+ *
+ * Note:
+ *    The prec digit decimal is round(|x|*10^k), computed in x87 long
+ *    double, and is checked with Decimal_to_double.  Trailing zeros
+ *    are dropped.  The layout follows %g: scientific if the decimal
+ *    exponent is below -4 or at least 17, fixed otherwise.
+ */
+static int Format_digits(
+      double  x      /* in  */,
+      int     prec   /* in  */,
+      char    out[]  /* out */) {
+#  ifdef HAVE_X87_LONG_DOUBLE
+   static const unsigned long long pow10u[] = {1ULL, 10ULL, 100ULL,
+      1000ULL, 10000ULL, 100000ULL, 1000000ULL, 10000000ULL, 100000000ULL,
+      1000000000ULL, 10000000000ULL, 100000000000ULL, 1000000000000ULL,
+      10000000000000ULL, 100000000000000ULL, 1000000000000000ULL,
+      10000000000000000ULL, 100000000000000000ULL};
+   long double a = x < 0 ? -(long double) x : (long double) x, s;
+   unsigned long long m;
+   double back;
+   char digits[20];
+   int e10 = 0, k, d = 0, len = 0, i, tries;
+
+   /* Decimal exponent: 10^e10 <= a < 10^(e10+1), fixed up below */
+   if (a >= 1)
+      while (e10 < 27 && a >= pow10l_tab[e10+1]) e10++;
+   else
+      for (e10 = -1; e10 > -27 && a*pow10l_tab[-e10] < 1; e10--);
+
+   for (tries = 0; ; tries++) {
+      k = prec - 1 - e10;
+      if (k < -27 || k > 27 || tries > 2) return -1;
+      s = k < 0 ? a / pow10l_tab[-k] : a * pow10l_tab[k];
+      m = (unsigned long long) (s + 0.5L);
+      if (m >= pow10u[prec]) e10++;
+      else if (m < pow10u[prec-1]) e10--;
+      else break;
+   }
+   if (!Decimal_to_double(m, -k, x < 0, &back)) return -1;
+   if (back != x) return 0;
+
+   while (m % 10 == 0) m /= 10;
+   do {
+      digits[d++] = '0' + m % 10;
+      m /= 10;
+   } while (m > 0);
+
+   if (x < 0) out[len++] = '-';
+   if (e10 < -4 || e10 >= 17) {
+      out[len++] = digits[--d];
+      if (d > 0) out[len++] = '.';
+      while (d > 0) out[len++] = digits[--d];
+      len += sprintf(out + len, "e%c%02d", e10 < 0 ? '-' : '+',
+            e10 < 0 ? -e10 : e10);
+      return len;
+   } else if (e10 < 0) {
+      out[len++] = '0';
+      out[len++] = '.';
+      for (i = -1; i > e10; i--) out[len++] = '0';
+      while (d > 0) out[len++] = digits[--d];
+   } else {
+      for (i = 0; d > 0 || i <= e10; i++) {
+         if (i == e10 + 1) out[len++] = '.';
+         out[len++] = d > 0 ? digits[--d] : '0';
+      }
+   }
+   out[len] = '\0';
+   return len;
+#  else
+   return -1;
+#  endif
+}  /* Format_digits */
+
+/*---------------------------------------------------------------------
+ * Function:  Format_double
+ * Purpose:   Write the shortest decimal text that strtod reads back
+ *            as x
+ * In arg:    x:    the number
+ * Out arg:   out:  the text, NUL terminated; at least MAX_DOUBLE_TEXT
+ *                  chars
+ * Ret val:   The length of the text
+ *
+ * Note:
+ *    Integers below 10^15 in magnitude are written digit by digit.
+ *    Otherwise the first of 15, 16 and 17 significant digits that
+ *    round-trips is used (17 always does).  For normal x there is at
+ *    most one 15 digit decimal that reads back as x, so dropping its
+ *    trailing zeros gives the shortest text.  The digits come from
+ *    Format_digits, or from snprintf and strtod at the same precision
+ *    when it can't decide:  going on to the next precision then could
+ *    miss the shortest text.
+ */
+int Format_double(
+      double  x      /* in  */,
+      char    out[]  /* out */) {
+   char digits[20];
+   unsigned long long u;
+   int len = 0, d = 0, prec;
+
+   if (x > -1e15 && x < 1e15 && x == (double) (long long) x) {
+      if (x < 0 || (x == 0 && 1/x < 0)) out[len++] = '-';
+      u = x < 0 ? (unsigned long long) -x : (unsigned long long) x;
+      do {
+         digits[d++] = '0' + u % 10;
+         u /= 10;
+      } while (u > 0);
+      while (d > 0) out[len++] = digits[--d];
+      out[len] = '\0';
+      return len;
+   }
+   for (prec = 15; prec < 17; prec++) {
+      len = x - x == 0 ? Format_digits(x, prec, out) : -1;  /* finite */
+      if (len > 0) return len;
+      if (len < 0) {
+         len = snprintf(out, MAX_DOUBLE_TEXT, "%.*g", prec, x);
+         if (strtod(out, NULL) == x) return len;
+      }
+   }
+   return snprintf(out, MAX_DOUBLE_TEXT, "%.17g", x);
+}  /* Format_double */
+
+#if ELEM_IS_FLOAT
+/*---------------------------------------------------------------------
+ * Function:  Format_float
+ * Purpose:   Write the shortest decimal text that strtof reads back
+ *            as x
+ * In arg:    x:    the number
+ * Out arg:   out:  the text, NUL terminated; at least MAX_DOUBLE_TEXT
+ *                  chars
+ * Ret val:   The length of the text
+ *
+ * Note:
+ *    Integers are written by Format_double.  Otherwise the first of
+ *    6, 7 and 8 significant digits that round-trips is used, and 9
+ *    always does.
+ */
+int Format_float(
+      float  x      /* in  */,
+      char   out[]  /* out */) {
+   int len, prec;
+
+   if (x > -1e15f && x < 1e15f && x == (float) (long long) x)
+      return Format_double(x, out);
+   for (prec = FLT_DIG; prec < 9; prec++) {
+      len = snprintf(out, MAX_DOUBLE_TEXT, "%.*g", prec, x);
+      if (strtof(out, NULL) == x) return len;
+   }
+   return snprintf(out, MAX_DOUBLE_TEXT, "%.9g", x);
+}  /* Format_float */
+#endif
 
 /*---------------------------------------------------------------------
  * Function:  Print_vector
@@ -106,18 +628,66 @@ void Read_vector(
  * In args:   b:  the vector to be printed
  *            n:  the order of the vector
  *            title:  title for print out
+ *
+ * Errors:    If the buffers can't be allocated, the program terminates
+ *
+ * Note:
+ *    Each round, every thread formats FORMAT_CHUNK elements into its
+ *    own buffer; the buffers are then written in order.
  */
 void Print_vector(
-      double  b[]     /* in */, 
-      int     n       /* in */, 
-      char    title[] /* in */) {
-   int i;
+      elem_t     b[]     /* in */, 
+      long long  n       /* in */, 
+      char       title[] /* in */) {
+   int thread_count = Thread_count(), t;
+   long long start;
+   size_t* lens;
+   char* bufs;
+
+   lens = malloc(thread_count*sizeof(size_t));
+   bufs = malloc((size_t) thread_count*FORMAT_CHUNK*(MAX_DOUBLE_TEXT + 1));
+   if (lens == NULL || bufs == NULL) {
+      fprintf(stderr, "Can't allocate output buffers\n");
+      exit(-1);
+   }
+
    printf("%s\n", title);
-   for (i = 0; i < n; i++)
-      printf("%f ", b[i]);
+   for (start = 0; start < n; start += (long long) thread_count*FORMAT_CHUNK) {
+#     pragma omp parallel for num_threads(thread_count) schedule(static, 1)
+      for (t = 0; t < thread_count; t++) {
+         char* out = bufs + (size_t) t*FORMAT_CHUNK*(MAX_DOUBLE_TEXT + 1);
+         long long i, first = start + (long long) t*FORMAT_CHUNK;
+         long long last = first + FORMAT_CHUNK < n ? first + FORMAT_CHUNK : n;
+         size_t len = 0;
+
+         for (i = first; i < last; i++) {
+            len += Format_elem(b[i], out + len);
+            out[len++] = ' ';
+         }
+         lens[t] = len;
+      }
+      for (t = 0; t < thread_count; t++)
+         fwrite(bufs + (size_t) t*FORMAT_CHUNK*(MAX_DOUBLE_TEXT + 1), 1,
+               lens[t], stdout);
+   }
    printf("\n");
+
+   free(lens);
+   free(bufs);
 }  /* Print_vector */
 
+/*---------------------------------------------------------------------
+ * Function:  Thread_count
+ * Purpose:   Number of threads used to parse and format text
+ */
+int Thread_count(void) {
+#  ifdef _OPENMP
+   return omp_get_max_threads();
+#  else
+   return 1;
+#  endif
+}  /* Thread_count */
+
 /*---------------------------------------------------------------------
  * Function:  Vector_sum
  * Purpose:   Add two vectors
@@ -127,12 +697,111 @@ void Print_vector(
  * Out arg:   z:  the sum vector
  */
 void Vector_sum(
-      double  x[]  /* in  */, 
-      double  y[]  /* in  */, 
-      double  z[]  /* out */, 
-      int     n    /* in  */) {
-   int i;
-
-   for (i = 0; i < n; i++)
-      z[i] = x[i] + y[i];
+      elem_t     x[]  /* in  */, 
+      elem_t     y[]  /* in  */, 
+      elem_t     z[]  /* out */, 
+      long long  n    /* in  */) {
+   Kernels.sum(x, y, z, n);
 }  /* Vector_sum */
+
+/*---------------------------------------------------------------------
+ * Function:  Map_vector
+ * Purpose:   Map a binary vector file read-only
+ * In arg:    path:  name of the file
+ * Out arg:   n_p:   the order of the vector
+ * Ret val:   Pointer to the first element in the mapping
+ *
+ * Errors:    If the file can't be mapped, or its header is bad or
+ *            doesn't match its size, the program terminates
+ */
+elem_t* Map_vector(
+      char       path[]  /* in  */,
+      long long* n_p     /* out */) {
+   int fd;
+   struct stat st;
+   char* base;
+   Vec_header* h;
+
+   fd = open(path, O_RDONLY);
+   if (fd < 0 || fstat(fd, &st) < 0) {
+      perror(path);
+      exit(-1);
+   }
+   if (st.st_size < VEC_HEADER_SIZE) {
+      fprintf(stderr, "%s: not a vector file\n", path);
+      exit(-1);
+   }
+   base = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+   close(fd);
+   if (base == MAP_FAILED) {
+      perror(path);
+      exit(-1);
+   }
+   h = (Vec_header*) base;
+   if (memcmp(h->magic, VEC_MAGIC, sizeof(h->magic)) != 0
+         || h->dtype != ELEM_DTYPE || h->elem_size != sizeof(elem_t)
+         || h->n <= 0
+         || st.st_size != VEC_HEADER_SIZE + h->n*(off_t) sizeof(elem_t)) {
+      fprintf(stderr, "%s: bad vector header or size\n", path);
+      exit(-1);
+   }
+   /* The kernels stream the whole vector once */
+   madvise(base, (size_t) st.st_size, MADV_SEQUENTIAL);
+
+   *n_p = h->n;
+   return (elem_t*) (base + VEC_HEADER_SIZE);
+}  /* Map_vector */
+
+/*---------------------------------------------------------------------
+ * Function:  Create_vector_file
+ * Purpose:   Create (or truncate) a binary vector file for n elements
+ *            and map it for writing
+ * In args:   path:  name of the file
+ *            n:     the order of the vector
+ * Ret val:   Pointer to the first element in the mapping
+ *
+ * Errors:    If the file can't be created or mapped, the program
+ *            terminates
+ */
+elem_t* Create_vector_file(
+      char       path[]  /* in */,
+      long long  n       /* in */) {
+   int fd;
+   size_t size = VEC_HEADER_SIZE + (size_t) n*sizeof(elem_t);
+   char* base;
+   Vec_header* h;
+
+   fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+   if (fd < 0 || ftruncate(fd, (off_t) size) < 0) {
+      perror(path);
+      exit(-1);
+   }
+   base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+   close(fd);
+   if (base == MAP_FAILED) {
+      perror(path);
+      exit(-1);
+   }
+   h = (Vec_header*) base;
+   memcpy(h->magic, VEC_MAGIC, sizeof(h->magic));
+   h->n = n;
+   h->dtype = ELEM_DTYPE;
+   h->elem_size = sizeof(elem_t);
+
+   return (elem_t*) (base + VEC_HEADER_SIZE);
+}  /* Create_vector_file */
+
+/*---------------------------------------------------------------------
+ * Function:  Unmap_vector
+ * Purpose:   Unmap a vector returned by Map_vector or
+ *            Create_vector_file.  Changes to a created file are
+ *            written back by the kernel.
+ * In args:   a:  first element of the vector
+ *            n:  the order of the vector
+ */
+void Unmap_vector(
+      elem_t     a[]  /* in */,
+      long long  n    /* in */) {
+   munmap((char*) a - VEC_HEADER_SIZE,
+         VEC_HEADER_SIZE + (size_t) n*sizeof(elem_t));
+}  /* Unmap_vector */
@@ -1,6 +1,8 @@
 /* File:     vector_add.c
  *
- * Compile:  gcc -g -Wall -o vector_add2 vector_add2.c
+ * Compile:  gcc -g -Wall -O2 -o vector_add2 vector_add2.c
+ *           (-DVEC_FLOAT or -DVEC_MIXED for float vectors, see
+ *           vector_type.h)
  * Run:      ./vector_add2 <number_of_elements>
  * 
  */
@@ -8,33 +10,47 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <time.h>
-
-void Read_n(int* n_p, int argc, char *argv[]);
-void Allocate_vectors(double** x_pp, double** y_pp, double** z_pp, int n);
-void Generate_random_vector(double a[], int n);
-void Print_vector(double b[], int n, char title[]);
-void Vector_sum(double x[], double y[], double z[], int n);
+#include "vector_kernels.h"
+#include "vector_type.h"
+
+/* Phases timed by main and printed by Report_phases */
+enum {ALLOC, INIT, COMPUTE, PRINT, PHASE_COUNT};
+char* phase_names[PHASE_COUNT] = {"alloc", "init", "compute", "print"};
+
+void Read_n(long long* n_p, int argc, char *argv[]);
+void Allocate_vectors(elem_t** x_pp, elem_t** y_pp, elem_t** z_pp,
+      long long n);
+void Generate_random_vector(elem_t a[], long long n);
+void Print_vector(elem_t b[], long long n, char title[]);
+void Vector_sum(elem_t x[], elem_t y[], elem_t z[], long long n);
+double Lap_ms(clock_t* start_p);
+void Report_phases(double phase_ms[], long long n);
 
 /*---------------------------------------------------------------------*/
 int main(int argc, char *argv[]) {
-   int n;
-   double *x, *y, *z;
+   long long n;
+   elem_t *x, *y, *z;
 
-   clock_t start, end;
+   clock_t start, end, lap;
    double cpu_time_used;
+   double phase_ms[PHASE_COUNT];
 
    // Leer el tamaño de los vectores desde los argumentos de línea de comandos
    Read_n(&n, argc, argv);
    srand(time(NULL));
+   printf("Using %s kernels on %s vectors\n", Select_kernels(), ELEM_NAME);
 
-   start = clock();
+   start = lap = clock();
 
    Allocate_vectors(&x, &y, &z, n);
+   phase_ms[ALLOC] = Lap_ms(&lap);
 
    Generate_random_vector(x, n);
    Generate_random_vector(y, n);
+   phase_ms[INIT] = Lap_ms(&lap);
 
    Vector_sum(x, y, z, n);
+   phase_ms[COMPUTE] = Lap_ms(&lap);
 
    end = clock();
 
@@ -43,9 +59,11 @@ int main(int argc, char *argv[]) {
    Print_vector(x, n, "\nVector x:");
    Print_vector(y, n, "\nVector y:");
    Print_vector(z, n, "\nThe sum is:");
+   phase_ms[PRINT] = Lap_ms(&lap);
 
    // Imprimir el tiempo de ejecución
    printf("\nTook %f ms to run\n", cpu_time_used);
+   Report_phases(phase_ms, n);
 
    free(x);
    free(y);
@@ -59,13 +77,13 @@ int main(int argc, char *argv[]) {
  * Purpose:   Read the order of the vectors from command line arguments
  * Out arg:   n_p: pointer to store the value of n
  */
-void Read_n(int* n_p, int argc, char *argv[]) {
+void Read_n(long long* n_p, int argc, char *argv[]) {
     if (argc < 2) {
         fprintf(stderr, "Usage: %s <number_of_elements>\n", argv[0]);
         exit(EXIT_FAILURE);
     }
     
-    *n_p = atoi(argv[1]);
+    *n_p = strtoll(argv[1], NULL, 10);
     if (*n_p <= 0) {
         fprintf(stderr, "Error: the order of the vector must be greater than 0.\n");
         exit(EXIT_FAILURE);
@@ -81,13 +99,13 @@ void Read_n(int* n_p, int argc, char *argv[]) {
  * Errors:    If one of the mallocs fails, the program terminates
  */
 void Allocate_vectors(
-      double**  x_pp  /* out */, 
-      double**  y_pp  /* out */, 
-      double**  z_pp  /* out */, 
-      int       n     /* in  */) {
-   *x_pp = malloc(n * sizeof(double));
-   *y_pp = malloc(n * sizeof(double));
-   *z_pp = malloc(n * sizeof(double));
+      elem_t**  x_pp  /* out */, 
+      elem_t**  y_pp  /* out */, 
+      elem_t**  z_pp  /* out */, 
+      long long n     /* in  */) {
+   *x_pp = malloc((size_t) n * sizeof(elem_t));
+   *y_pp = malloc((size_t) n * sizeof(elem_t));
+   *z_pp = malloc((size_t) n * sizeof(elem_t));
    if (*x_pp == NULL || *y_pp == NULL || *z_pp == NULL) {
       fprintf(stderr, "Can't allocate vectors\n");
       exit(-1);
@@ -101,9 +119,9 @@ void Allocate_vectors(
  * Out arg:   a:  the vector to be filled with random numbers
  */
 void Generate_random_vector(
-      double  a[]   /* out */, 
-      int     n     /* in  */) {
-   for (int i = 0; i < n; i++)
+      elem_t     a[]   /* out */, 
+      long long  n     /* in  */) {
+   for (long long i = 0; i < n; i++)
       a[i] = ((double) rand() / RAND_MAX) * 100.0; // Valores aleatorios entre 0 y 100
 }  /* Generate_random_vector */
 
@@ -115,17 +133,17 @@ void Generate_random_vector(
  *            title:  title for print out
  */
 void Print_vector(
-      double  b[]     /* in */, 
-      int     n       /* in */, 
-      char    title[] /* in */) {
-   int i;
+      elem_t     b[]     /* in */, 
+      long long  n       /* in */, 
+      char       title[] /* in */) {
+   long long i;
    printf("%s\n", title);
    printf("First 10 elements:\n");
    for (i = 0; i < 10 && i < n; i++)
-      printf("%f ", b[i]);
+      printf(ELEM_FMT " ", b[i]);
    printf("\nLast 10 elements:\n");
-   for (i = n - 10; i < n; i++)
-      printf("%f ", b[i]);
+   for (i = n > 10 ? n - 10 : 0; i < n; i++)
+      printf(ELEM_FMT " ", b[i]);
    printf("\n");
 }  /* Print_vector */
 
@@ -138,12 +156,45 @@ void Print_vector(
  * Out arg:   z:  the sum vector
  */
 void Vector_sum(
-      double  x[]  /* in  */, 
-      double  y[]  /* in  */, 
-      double  z[]  /* out */, 
-      int     n    /* in  */) {
-   int i;
-
-   for (i = 0; i < n; i++)
-      z[i] = x[i] + y[i];
+      elem_t     x[]  /* in  */, 
+      elem_t     y[]  /* in  */, 
+      elem_t     z[]  /* out */, 
+      long long  n    /* in  */) {
+   Kernels.sum(x, y, z, n);
 }  /* Vector_sum */
+
+/*---------------------------------------------------------------------
+ * Function:  Lap_ms
+ * Purpose:   Return the milliseconds of CPU time used since *start_p
+ *            and restart the lap at the current time
+ * In/out arg:  start_p:  clock() at the start of the lap
+ */
+double Lap_ms(clock_t* start_p /* in/out */) {
+   clock_t now = clock();
+   double ms = ((double) (now - *start_p)) / CLOCKS_PER_SEC * 1000;
+
+   *start_p = now;
+   return ms;
+}  /* Lap_ms */
+
+/*---------------------------------------------------------------------
+ * Function:  Report_phases
+ * Purpose:   Print the phase times as one JSON line starting with
+ *            "TIMING ", in the same format as the MPI programs (with a
+ *            single process min = avg = max)
+ * In args:   phase_ms:  time in each phase (ms)
+ *            n:         order of the vectors
+ */
+void Report_phases(
+      double     phase_ms[]  /* in */,
+      long long  n           /* in */) {
+   int p;
+
+   printf("TIMING {\"program\":\"vector_add2\",\"comm_sz\":1,\"threads\":1,"
+         "\"n\":%lld,\"unit\":\"ms\",\"phases\":{", n);
+   for (p = 0; p < PHASE_COUNT; p++)
+      printf("%s\"%s\":{\"min\":%.3f,\"avg\":%.3f,\"max\":%.3f}",
+            p > 0 ? "," : "", phase_names[p], phase_ms[p], phase_ms[p],
+            phase_ms[p]);
+   printf("}}\n");
+}  /* Report_phases */
@@ -0,0 +1,744 @@
+/* File:     vector_expr.h
+ *
+ * Purpose:  A small compiler and interpreter for elementwise
+ *           expressions over vectors, with reductions, evaluated in a
+ *           single fused pass.
+ *
+ * Usage:    Expr_program prog;  (link with -lm)
+ *           if (Expr_compile(&prog, "z = a*x + y; n2 = norm(z)",
+ *                 names, 2, scalar_names, scalars, 1) != 0)
+ *              ... prog.error says why ...
+ *           vecs[0..1] = inputs, vecs[2..prog.vec_count-1] = outputs
+ *           Expr_select(Select_kernels());    (optional, see note 3)
+ *           Expr_start(&prog, partial);
+ *           Expr_run(&prog, vecs, first, count, partial);  (per thread)
+ *           Expr_merge(&prog, total, partial);    (threads, processes)
+ *           Expr_finish(&prog, total);
+ *
+ * Language: statements separated by ';' or newlines:
+ *              name = expr           store expr in vector name
+ *              name := expr          temporary:  never stored, only
+ *                                    usable by later statements
+ *              name = sum(expr)      reductions over all the elements;
+ *              name = min(expr)      norm is sqrt(sum(expr*expr))
+ *              name = max(expr)
+ *              name = norm(expr)
+ *           where expr has numbers, input vectors, scalars, vectors
+ *           and temporaries assigned earlier, + - * /, unary -,
+ *           parentheses, sqrt(expr) and abs(expr).
+ *
+ * Notes:
+ * 1.  Expr_compile turns the statements into a list of Expr_ops on
+ *     registers that each hold EXPR_CHUNK elements.  Expr_run walks
+ *     its range chunk by chunk and runs the whole list on each chunk,
+ *     so every input element is loaded once and every output written
+ *     once, however many statements use it, and an intermediate
+ *     result only ever lives in a register that fits in L1.  The
+ *     dispatch on the op code is paid once per chunk, not per element.
+ * 2.  Registers are allocated as a stack from the bottom (the
+ *     intermediate results of the statement being compiled) and from
+ *     the top (constants, filled once by Expr_run, and temporaries).
+ *     When vectors hold acc_t, ops read input vectors and write
+ *     output vectors in place rather than through a register, and
+ *     sum(a*b) is a single dot product op.
+ * 3.  At -O2 compilers neither vectorize loops whose operands may
+ *     overlap nor reassociate sums, so the loops of Expr_run are
+ *     marked "omp simd", and Expr_run is built for AVX2 and AVX-512
+ *     as well as for the default target.  Expr_select picks the one
+ *     matching the kernels chosen by Select_kernels (vector_kernels.h),
+ *     so VECTOR_KERNELS applies to it too.
+ * 4.  Statements run in order on each element, so a statement that
+ *     overwrites an input is seen by the statements after it, as
+ *     if each had run over the whole vector.
+ * 5.  The arithmetic is done in acc_t (see vector_type.h):  with
+ *     -DVEC_MIXED float inputs are widened and results rounded to
+ *     float only when stored.
+ * 6.  The partial results of all the reductions are one array of
+ *     acc_t, so a single message (e.g. an MPI_Reduce with an op
+ *     calling Expr_merge) combines all of them.
+ * 7.  A reduction's value is only known after the pass, so it can't
+ *     be used in an expression.
+ */
+#ifndef VECTOR_EXPR_H
+#define VECTOR_EXPR_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <math.h>
+#include "vector_type.h"
+
+#define EXPR_VECS 16     /* vectors, inputs included          */
+#define EXPR_REDS 16     /* reductions                        */
+#define EXPR_REGS 16     /* registers of EXPR_CHUNK elements  */
+#define EXPR_OPS 256     /* ops in a program                  */
+#define EXPR_NAME 32     /* longest name, with the '\0'       */
+#define EXPR_ERROR 128   /* longest error message             */
+#define EXPR_CHUNK 256   /* elements per register             */
+
+/* The loops of Expr_run have no dependences between elements (an
+ * operand may be both read and written, but only element by element),
+ * and reductions may be reassociated (see note 3) */
+#define EXPR_PRAGMA(text) _Pragma(#text)
+#define EXPR_SIMD EXPR_PRAGMA(omp simd)
+#define EXPR_SIMD_REDUCE(op) EXPR_PRAGMA(omp simd reduction(op: s))
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define EXPR_X86 1
+#endif
+#ifdef __GNUC__
+#define EXPR_INLINE inline __attribute__((always_inline))
+#else
+#define EXPR_INLINE inline
+#endif
+
+/* Op codes:  dst = a op b, dst = vector a, vector dst = a, ... */
+enum {EXPR_LOAD, EXPR_STORE, EXPR_MOV, EXPR_ADD, EXPR_SUB, EXPR_MUL,
+   EXPR_DIV, EXPR_NEG, EXPR_SQRT, EXPR_ABS, EXPR_SUM, EXPR_MIN,
+   EXPR_MAX, EXPR_NORM, EXPR_DOT};
+
+/* Operands r >= EXPR_REGS are vector r - EXPR_REGS itself.  Vectors
+ * are only used directly when their elements are acc_t; with
+ * -DVEC_MIXED they are widened by EXPR_LOAD and narrowed by EXPR_STORE */
+#define EXPR_DIRECT (sizeof(elem_t) == sizeof(acc_t))
+
+typedef struct {
+   int  code;
+   int  dst;     /* register or vector, or reduction for EXPR_SUM, ... */
+   int  a, b;    /* registers or vectors, or vector a for EXPR_LOAD   */
+} Expr_op;
+
+/* Names, their kinds in Expr_program */
+enum {EXPR_NONE, EXPR_VECTOR, EXPR_TEMP, EXPR_SCALAR, EXPR_REDUCTION};
+
+typedef struct {
+   int      op_count;
+   Expr_op  ops[EXPR_OPS];
+   int      input_count;               /* vectors 0..input_count-1  */
+   int      vec_count;
+   char     vec_names[EXPR_VECS][EXPR_NAME];
+   int      red_count;
+   char     red_names[EXPR_REDS][EXPR_NAME];
+   int      red_kind[EXPR_REDS];       /* EXPR_SUM, ..., EXPR_NORM  */
+   int      reg_count;                 /* registers used from 0 up  */
+   int      top;                       /* lowest register from the top */
+   int      const_count;
+   int      const_reg[EXPR_REGS];
+   acc_t    const_value[EXPR_REGS];
+   int      temp_count;
+   char     temp_names[EXPR_REGS][EXPR_NAME];
+   int      temp_reg[EXPR_REGS];
+   char     error[EXPR_ERROR];
+} Expr_program;
+
+/* Parser state, only used by Expr_compile */
+typedef struct {
+   Expr_program*  prog;
+   const char*    p;                   /* next character to read    */
+   int            scalar_count;
+   const char**   scalar_names;
+   const double*  scalars;
+} Expr_parser;
+
+static int Expr_expr(Expr_parser* ps, int free_reg);
+
+/*---------------------------------------------------------------------
+ * Function:  Expr_fail
+ * Purpose:   Record the first error of a compilation
+ * Ret val:   -1, for the callers to return
+ */
+static int Expr_fail(Expr_parser* ps /* in/out */, const char* what,
+      const char* name) {
+   Expr_program* prog = ps->prog;
+
+   if (name != NULL && *name == '\0') name = "the end";
+   if (prog->error[0] == '\0')
+      snprintf(prog->error, EXPR_ERROR, "%s%s%s", what,
+            name != NULL ? " " : "", name != NULL ? name : "");
+   return -1;
+}  /* Expr_fail */
+
+/*---------------------------------------------------------------------
+ * Function:  Expr_skip
+ * Purpose:   Skip blanks (not newlines, which end a statement)
+ */
+static void Expr_skip(Expr_parser* ps /* in/out */) {
+   while (*ps->p == ' ' || *ps->p == '\t' || *ps->p == '\r') ps->p++;
+}  /* Expr_skip */
+
+/*---------------------------------------------------------------------
+ * Function:  Expr_accept
+ * Purpose:   Read the character c if it's next
+ * Ret val:   1 if it was read, 0 otherwise
+ */
+static int Expr_accept(Expr_parser* ps /* in/out */, char c /* in */) {
+   Expr_skip(ps);
+   if (*ps->p != c) return 0;
+   ps->p++;
+   return 1;
+}  /* Expr_accept */
+
+/*---------------------------------------------------------------------
+ * Function:  Expr_name
+ * Purpose:   Read a name ([A-Za-z_][A-Za-z0-9_]*) if one is next
+ * Out arg:   name
+ * Ret val:   1 if a name was read, 0 if there's none, -1 if too long
+ */
+static int Expr_name(Expr_parser* ps /* in/out */,
+      char name[EXPR_NAME] /* out */) {
+   int len = 0;
+
+   Expr_skip(ps);
+   if (!isalpha((unsigned char) *ps->p) && *ps->p != '_') return 0;
+   while (isalnum((unsigned char) ps->p[len]) || ps->p[len] == '_') len++;
+   if (len >= EXPR_NAME) return Expr_fail(ps, "name too long at", ps->p);
+   memcpy(name, ps->p, len);
+   name[len] = '\0';
+   ps->p += len;
+   return 1;
+}  /* Expr_name */
+
+/*---------------------------------------------------------------------
+ * Function:  Expr_lookup
+ * Purpose:   Find what a name stands for
+ * Out arg:   index_p:  the vector, temporary, scalar or reduction
+ * Ret val:   EXPR_VECTOR, ..., EXPR_REDUCTION, or EXPR_NONE
+ */
+static int Expr_lookup(Expr_parser* ps /* in */, const char* name,
+      int* index_p /* out */) {
+   Expr_program* prog = ps->prog;
+   int i;
+
+   for (i = 0; i < prog->vec_count; i++)
+      if (strcmp(prog->vec_names[i], name) == 0) {
+         *index_p = i;
+         return EXPR_VECTOR;
+      }
+   for (i = 0; i < prog->temp_count; i++)
+      if (strcmp(prog->temp_names[i], name) == 0) {
+         *index_p = i;
+         return EXPR_TEMP;
+      }
+   for (i = 0; i < ps->scalar_count; i++)
+      if (strcmp(ps->scalar_names[i], name) == 0) {
+         *index_p = i;
+         return EXPR_SCALAR;
+      }
+   for (i = 0; i < prog->red_count; i++)
+      if (strcmp(prog->red_names[i], name) == 0) {
+         *index_p = i;
+         return EXPR_REDUCTION;
+      }
+   return EXPR_NONE;
+}  /* Expr_lookup */
+
+/*---------------------------------------------------------------------
+ * Function:  Expr_emit
+ * Purpose:   Append an op to the program
+ * Ret val:   dst, or -1 if the program is full
+ */
+static int Expr_emit(Expr_parser* ps /* in/out */, int code, int dst,
+      int a, int b) {
+   Expr_program* prog = ps->prog;
+   Expr_op* op;
+
+   if (prog->op_count == EXPR_OPS)
+      return Expr_fail(ps, "too many operations", NULL);
+   op = &prog->ops[prog->op_count++];
+   op->code = code;
+   op->dst = dst;
+   op->a = a;
+   op->b = b;
+   return dst;
+}  /* Expr_emit */
+
+/*---------------------------------------------------------------------
+ * Function:  Expr_use_reg
+ * Purpose:   Claim register r from the bottom of the register file
+ * Ret val:   r, or -1 if it's taken by a constant or temporary
+ */
+static int Expr_use_reg(Expr_parser* ps /* in/out */, int r /* in */) {
+   Expr_program* prog = ps->prog;
+
+   if (r >= prog->top)
+      return Expr_fail(ps, "expression too complex", NULL);
+   if (r + 1 > prog->reg_count) prog->reg_count = r + 1;
+   return r;
+}  /* Expr_use_reg */
+
+/*---------------------------------------------------------------------
+ * Function:  Expr_constant
+ * Purpose:   Find or make the register holding a constant
+ * Ret val:   the register, or -1 if there's no room
+ */
+static int Expr_constant(Expr_parser* ps /* in/out */,
+      double value /* in */) {
+   Expr_program* prog = ps->prog;
+   int i;
+
+   for (i = 0; i < prog->const_count; i++)
+      if (prog->const_value[i] == (acc_t) value)
+         return prog->const_reg[i];
+   if (prog->top <= prog->reg_count)
+      return Expr_fail(ps, "too many constants and temporaries", NULL);
+   prog->top--;
+   prog->const_reg[prog->const_count] = prog->top;
+   prog->const_value[prog->const_count++] = (acc_t) value;
+   return prog->top;
+}  /* Expr_constant */
+
+/*---------------------------------------------------------------------
+ * Function:  Expr_primary
+ * Purpose:   Compile a number, a name, a call or (expr)
+ * In arg:    free_reg:  lowest register the code may write
+ * Ret val:   the register holding the value:  free_reg, or a
+ *            constant's or temporary's register; -1 on errors
+ */
+static int Expr_primary(Expr_parser* ps /* in/out */, int free_reg) {
+   char name[EXPR_NAME], *end;
+   int found, index, r, code;
+   double value;
+
+   if (Expr_accept(ps, '(')) {
+      r = Expr_expr(ps, free_reg);
+      if (r >= 0 && !Expr_accept(ps, ')'))
+         return Expr_fail(ps, "expected ) at", ps->p);
+      return r;
+   }
+   if (isdigit((unsigned char) *ps->p) || *ps->p == '.') {
+      value = strtod(ps->p, &end);
+      if (end == ps->p) return Expr_fail(ps, "bad number at", ps->p);
+      ps->p = end;
+      return Expr_constant(ps, value);
+   }
+   found = Expr_name(ps, name);
+   if (found < 0) return -1;
+   if (found == 0) return Expr_fail(ps, "expected a value at", ps->p);
+
+   if (strcmp(name, "sqrt") == 0 || strcmp(name, "abs") == 0) {
+      code = name[0] == 's' ? EXPR_SQRT : EXPR_ABS;
+      if (!Expr_accept(ps, '('))
+         return Expr_fail(ps, "expected ( after", name);
+      r = Expr_expr(ps, free_reg);
+      if (r < 0) return -1;
+      if (!Expr_accept(ps, ')'))
+         return Expr_fail(ps, "expected ) at", ps->p);
+      if (Expr_use_reg(ps, free_reg) < 0) return -1;
+      return Expr_emit(ps, code, free_reg, r, -1);
+   }
+
+   switch (Expr_lookup(ps, name, &index)) {
+      case EXPR_VECTOR:
+         if (EXPR_DIRECT) return EXPR_REGS + index;
+         if (Expr_use_reg(ps, free_reg) < 0) return -1;
+         return Expr_emit(ps, EXPR_LOAD, free_reg, index, -1);
+      case EXPR_TEMP:
+         return ps->prog->temp_reg[index];
+      case EXPR_SCALAR:
+         return Expr_constant(ps, ps->scalars[index]);
+      case EXPR_REDUCTION:
+         return Expr_fail(ps, "can't use the reduction", name);
+   }
+   return Expr_fail(ps, "unknown name", name);
+}  /* Expr_primary */
+
+/*---------------------------------------------------------------------
+ * Function:  Expr_unary
+ * Purpose:   Compile [-]primary
+ */
+static int Expr_unary(Expr_parser* ps /* in/out */, int free_reg) {
+   int r;
+
+   if (!Expr_accept(ps, '-')) return Expr_primary(ps, free_reg);
+   r = Expr_unary(ps, free_reg);
+   if (r < 0 || Expr_use_reg(ps, free_reg) < 0) return -1;
+   return Expr_emit(ps, EXPR_NEG, free_reg, r, -1);
+}  /* Expr_unary */
+
+/*---------------------------------------------------------------------
+ * Function:  Expr_binary
+ * Purpose:   Compile a chain of operands joined by op1 or op2:  level 0
+ *            is + and - of terms, level 1 is * and / of unaries
+ * Note:
+ *    The left operand is in free_reg (or a constant's or temporary's
+ *    register), so the right one is compiled from free_reg + 1 only
+ *    when free_reg is taken.
+ */
+static int Expr_binary(Expr_parser* ps /* in/out */, int free_reg,
+      int level) {
+   char op1 = level == 0 ? '+' : '*', op2 = level == 0 ? '-' : '/';
+   int l, r, code;
+
+   l = level == 0 ? Expr_binary(ps, free_reg, 1)
+      : Expr_unary(ps, free_reg);
+   while (l >= 0) {
+      if (Expr_accept(ps, op1))
+         code = level == 0 ? EXPR_ADD : EXPR_MUL;
+      else if (Expr_accept(ps, op2))
+         code = level == 0 ? EXPR_SUB : EXPR_DIV;
+      else
+         break;
+      r = level == 0
+         ? Expr_binary(ps, l == free_reg ? free_reg + 1 : free_reg, 1)
+         : Expr_unary(ps, l == free_reg ? free_reg + 1 : free_reg);
+      if (r < 0 || Expr_use_reg(ps, free_reg) < 0) return -1;
+      l = Expr_emit(ps, code, free_reg, l, r);
+   }
+   return l;
+}  /* Expr_binary */
+
+static int Expr_expr(Expr_parser* ps /* in/out */, int free_reg) {
+   return Expr_binary(ps, free_reg, 0);
+}  /* Expr_expr */
+
+/*---------------------------------------------------------------------
+ * Function:  Expr_last
+ * Purpose:   Find whether register r, a statement's value, was just
+ *            computed by the last op into a register of the stack, so
+ *            that op can be changed to send its result elsewhere
+ * Ret val:   the code of the last op (EXPR_MOV, ..., EXPR_ABS), or -1
+ */
+static int Expr_last(Expr_parser* ps /* in */, int r /* in */) {
+   Expr_program* prog = ps->prog;
+   Expr_op* last;
+
+   if (prog->op_count == 0 || r >= prog->top) return -1;
+   last = &prog->ops[prog->op_count - 1];
+   if (last->dst != r || last->code < EXPR_MOV || last->code >= EXPR_SUM)
+      return -1;
+   return last->code;
+}  /* Expr_last */
+
+/*---------------------------------------------------------------------
+ * Function:  Expr_statement
+ * Purpose:   Compile one statement (see Language above)
+ * Ret val:   0, or -1 on errors
+ */
+static int Expr_statement(Expr_parser* ps /* in/out */) {
+   Expr_program* prog = ps->prog;
+   char name[EXPR_NAME], call[EXPR_NAME];
+   const char* after_name;
+   Expr_op* last;
+   int temp, kind, index, r, code = -1;
+
+   if (Expr_name(ps, name) <= 0)
+      return Expr_fail(ps, "expected a name at", ps->p);
+   temp = Expr_accept(ps, ':');
+   if (!Expr_accept(ps, '='))
+      return Expr_fail(ps, "expected = after", name);
+   kind = Expr_lookup(ps, name, &index);
+
+   // ¿Es una reducción?  sum(, min(, max( o norm(
+   after_name = ps->p;
+   if (!temp && Expr_name(ps, call) > 0 && Expr_accept(ps, '(')) {
+      if (strcmp(call, "sum") == 0) code = EXPR_SUM;
+      else if (strcmp(call, "min") == 0) code = EXPR_MIN;
+      else if (strcmp(call, "max") == 0) code = EXPR_MAX;
+      else if (strcmp(call, "norm") == 0) code = EXPR_NORM;
+   }
+   if (code < 0) ps->p = after_name;
+
+   if (code >= 0) {
+      if (kind != EXPR_NONE)
+         return Expr_fail(ps, "reduction to a name already used:", name);
+      if (prog->red_count == EXPR_REDS)
+         return Expr_fail(ps, "too many reductions", NULL);
+      r = Expr_expr(ps, 0);
+      if (r < 0) return -1;
+      if (!Expr_accept(ps, ')'))
+         return Expr_fail(ps, "expected ) at", ps->p);
+      strcpy(prog->red_names[prog->red_count], name);
+      prog->red_kind[prog->red_count] = code;
+      // sum(a*b) en una sola operación, sin guardar los productos
+      if (code == EXPR_SUM && Expr_last(ps, r) == EXPR_MUL) {
+         last = &prog->ops[prog->op_count - 1];
+         last->code = EXPR_DOT;
+         last->dst = prog->red_count++;
+         return 0;
+      }
+      return Expr_emit(ps, code, prog->red_count++, r, -1) < 0 ? -1 : 0;
+   }
+
+   r = Expr_expr(ps, 0);
+   if (r < 0) return -1;
+   if (temp) {
+      if (kind != EXPR_NONE && kind != EXPR_TEMP)
+         return Expr_fail(ps, "temporary with a name already used:", name);
+      if (kind == EXPR_NONE) {
+         if (prog->top <= prog->reg_count)
+            return Expr_fail(ps, "too many constants and temporaries",
+                  NULL);
+         index = prog->temp_count++;
+         strcpy(prog->temp_names[index], name);
+         prog->temp_reg[index] = --prog->top;
+      }
+      return Expr_emit(ps, EXPR_MOV, prog->temp_reg[index], r, -1) < 0
+         ? -1 : 0;
+   }
+   if (kind != EXPR_NONE && kind != EXPR_VECTOR)
+      return Expr_fail(ps, "vector with a name already used:", name);
+   if (kind == EXPR_NONE) {
+      if (prog->vec_count == EXPR_VECS)
+         return Expr_fail(ps, "too many vectors", NULL);
+      index = prog->vec_count++;
+      strcpy(prog->vec_names[index], name);
+   }
+   // La última operación escribe directamente en el vector
+   if (EXPR_DIRECT && Expr_last(ps, r) >= EXPR_MOV) {
+      prog->ops[prog->op_count - 1].dst = EXPR_REGS + index;
+      return 0;
+   }
+   return Expr_emit(ps, EXPR_STORE, EXPR_REGS + index, r, -1) < 0 ? -1 : 0;
+}  /* Expr_statement */
+
+/*---------------------------------------------------------------------
+ * Function:  Expr_compile
+ * Purpose:   Compile a program (see Language above)
+ * In args:   text:          the statements
+ *            inputs:        names of the input vectors
+ *            input_count:   at most EXPR_VECS
+ *            scalar_names:  names of the scalars, replaced by their
+ *            scalars:       values
+ *            scalar_count
+ * Out arg:   prog:          the program:  vectors 0..input_count-1 are
+ *                           the inputs, the others the outputs in the
+ *                           order they are first assigned
+ * Ret val:   0, or -1 with a message in prog->error
+ */
+static int Expr_compile(
+      Expr_program*  prog          /* out */,
+      const char*    text          /* in  */,
+      const char*    inputs[]      /* in  */,
+      int            input_count   /* in  */,
+      const char*    scalar_names[] /* in */,
+      const double   scalars[]     /* in  */,
+      int            scalar_count  /* in  */) {
+   Expr_parser ps = {prog, text, scalar_count, scalar_names, scalars};
+   int i, statements = 0;
+
+   memset(prog, 0, sizeof(Expr_program));
+   prog->top = EXPR_REGS;
+   for (i = 0; i < input_count; i++)
+      snprintf(prog->vec_names[i], EXPR_NAME, "%s", inputs[i]);
+   prog->input_count = prog->vec_count = input_count;
+
+   for (;;) {
+      while (Expr_accept(&ps, ';') || Expr_accept(&ps, '\n'))
+         ;
+      if (*ps.p == '\0') break;
+      if (Expr_statement(&ps) < 0) return -1;
+      statements++;
+      Expr_skip(&ps);
+      if (*ps.p != '\0' && *ps.p != ';' && *ps.p != '\n')
+         return Expr_fail(&ps, "expected ; at", ps.p);
+   }
+   if (statements == 0) return Expr_fail(&ps, "no statements", NULL);
+   return 0;
+}  /* Expr_compile */
+
+/*---------------------------------------------------------------------
+ * Function:  Expr_start
+ * Purpose:   Set partial results to the identity of their reductions
+ */
+static void Expr_start(const Expr_program* prog /* in */,
+      acc_t partial[] /* out */) {
+   int i;
+
+   for (i = 0; i < prog->red_count; i++)
+      partial[i] = prog->red_kind[i] == EXPR_MIN ? INFINITY
+         : prog->red_kind[i] == EXPR_MAX ? -INFINITY : 0;
+}  /* Expr_start */
+
+/*---------------------------------------------------------------------
+ * Function:  Expr_merge
+ * Purpose:   Combine two sets of partial results:  total op= partial
+ */
+static void Expr_merge(const Expr_program* prog /* in */,
+      acc_t total[] /* in/out */, const acc_t partial[] /* in */) {
+   int i;
+
+   for (i = 0; i < prog->red_count; i++)
+      if (prog->red_kind[i] == EXPR_MIN)
+         total[i] = partial[i] < total[i] ? partial[i] : total[i];
+      else if (prog->red_kind[i] == EXPR_MAX)
+         total[i] = partial[i] > total[i] ? partial[i] : total[i];
+      else
+         total[i] += partial[i];
+}  /* Expr_merge */
+
+/*---------------------------------------------------------------------
+ * Function:  Expr_finish
+ * Purpose:   Turn the combined partial results into the values of the
+ *            reductions (the square root of norm's sum of squares)
+ */
+static void Expr_finish(const Expr_program* prog /* in */,
+      acc_t total[] /* in/out */) {
+   int i;
+
+   for (i = 0; i < prog->red_count; i++)
+      if (prog->red_kind[i] == EXPR_NORM) total[i] = sqrt(total[i]);
+}  /* Expr_finish */
+
+/*---------------------------------------------------------------------
+ * Function:  Expr_body
+ * Purpose:   Run a program on elements first, ..., first+count-1 of
+ *            its vectors:  the body of every Expr_run_* (see note 3)
+ * In args:   prog, first, count
+ * In/out args:  vecs:     the vectors (outputs written)
+ *               partial:  partial results of the reductions, combined
+ *                         with those of these elements
+ */
+static EXPR_INLINE void Expr_body(
+      const Expr_program*  prog       /* in     */,
+      elem_t*              vecs[]     /* in/out */,
+      long long            first      /* in     */,
+      long long            count      /* in     */,
+      acc_t                partial[]  /* in/out */) {
+   acc_t reg[EXPR_REGS][EXPR_CHUNK] __attribute__((aligned(64)));
+   long long start;
+   int c, i, k, len;
+
+   for (c = 0; c < prog->const_count; c++)
+      for (i = 0; i < EXPR_CHUNK; i++)
+         reg[prog->const_reg[c]][i] = prog->const_value[c];
+
+#  define EXPR_OPERAND(r) ((r) < EXPR_REGS ? reg[r] \
+      : (acc_t*) (vecs[(r) - EXPR_REGS] + start))
+   for (start = first; start < first + count; start += EXPR_CHUNK) {
+      len = first + count - start < EXPR_CHUNK
+         ? (int) (first + count - start) : EXPR_CHUNK;
+      for (k = 0; k < prog->op_count; k++) {
+         const Expr_op* op = &prog->ops[k];
+         acc_t* d = op->code < EXPR_SUM ? EXPR_OPERAND(op->dst) : NULL;
+         const acc_t* a = op->code != EXPR_LOAD ? EXPR_OPERAND(op->a) : NULL;
+         const acc_t* b = op->b >= 0 ? EXPR_OPERAND(op->b) : NULL;
+         elem_t* v;
+         acc_t s;
+
+         switch (op->code) {
+            case EXPR_LOAD:
+               v = vecs[op->a] + start;
+               EXPR_SIMD
+               for (i = 0; i < len; i++) d[i] = v[i];
+               break;
+            case EXPR_STORE:
+               v = vecs[op->dst - EXPR_REGS] + start;
+               EXPR_SIMD
+               for (i = 0; i < len; i++) v[i] = (elem_t) a[i];
+               break;
+            case EXPR_MOV:
+               EXPR_SIMD
+               for (i = 0; i < len; i++) d[i] = a[i];
+               break;
+            case EXPR_ADD:
+               EXPR_SIMD
+               for (i = 0; i < len; i++) d[i] = a[i] + b[i];
+               break;
+            case EXPR_SUB:
+               EXPR_SIMD
+               for (i = 0; i < len; i++) d[i] = a[i] - b[i];
+               break;
+            case EXPR_MUL:
+               EXPR_SIMD
+               for (i = 0; i < len; i++) d[i] = a[i]*b[i];
+               break;
+            case EXPR_DIV:
+               EXPR_SIMD
+               for (i = 0; i < len; i++) d[i] = a[i]/b[i];
+               break;
+            case EXPR_NEG:
+               EXPR_SIMD
+               for (i = 0; i < len; i++) d[i] = -a[i];
+               break;
+            case EXPR_SQRT:
+               EXPR_SIMD
+               for (i = 0; i < len; i++) d[i] = sqrt(a[i]);
+               break;
+            case EXPR_ABS:
+               EXPR_SIMD
+               for (i = 0; i < len; i++) d[i] = fabs(a[i]);
+               break;
+            case EXPR_SUM:
+               s = 0;
+               EXPR_SIMD_REDUCE(+)
+               for (i = 0; i < len; i++) s += a[i];
+               partial[op->dst] += s;
+               break;
+            case EXPR_NORM:
+               s = 0;
+               EXPR_SIMD_REDUCE(+)
+               for (i = 0; i < len; i++) s += a[i]*a[i];
+               partial[op->dst] += s;
+               break;
+            case EXPR_DOT:
+               s = 0;
+               EXPR_SIMD_REDUCE(+)
+               for (i = 0; i < len; i++) s += a[i]*b[i];
+               partial[op->dst] += s;
+               break;
+            case EXPR_MIN:
+               s = partial[op->dst];
+               EXPR_SIMD_REDUCE(min)
+               for (i = 0; i < len; i++)
+                  s = a[i] < s ? a[i] : s;
+               partial[op->dst] = s;
+               break;
+            case EXPR_MAX:
+               s = partial[op->dst];
+               EXPR_SIMD_REDUCE(max)
+               for (i = 0; i < len; i++)
+                  s = a[i] > s ? a[i] : s;
+               partial[op->dst] = s;
+               break;
+         }
+      }
+   }
+#  undef EXPR_OPERAND
+}  /* Expr_body */
+
+/*---------------------------------------------------------------------
+ * Expr_body built for each target:  Expr_run points to one of these
+ */
+static void Expr_run_default(const Expr_program* prog, elem_t* vecs[],
+      long long first, long long count, acc_t partial[]) {
+   Expr_body(prog, vecs, first, count, partial);
+}  /* Expr_run_default */
+
+#ifdef EXPR_X86
+__attribute__((target("avx2")))
+static void Expr_run_avx2(const Expr_program* prog, elem_t* vecs[],
+      long long first, long long count, acc_t partial[]) {
+   Expr_body(prog, vecs, first, count, partial);
+}  /* Expr_run_avx2 */
+
+__attribute__((target("avx512f")))
+static void Expr_run_avx512(const Expr_program* prog, elem_t* vecs[],
+      long long first, long long count, acc_t partial[]) {
+   Expr_body(prog, vecs, first, count, partial);
+}  /* Expr_run_avx512 */
+#endif
+
+/* Run a program on elements first, ..., first+count-1 of its vectors,
+ * see Expr_body; set by Expr_select */
+static void (*Expr_run)(const Expr_program* prog, elem_t* vecs[],
+      long long first, long long count, acc_t partial[]) =
+   Expr_run_default;
+
+/*---------------------------------------------------------------------
+ * Function:  Expr_select
+ * Purpose:   Choose the Expr_run for a set of kernels
+ * In arg:    kernels:  the name Select_kernels returned ("avx512",
+ *                      "avx2", "sse2" or "scalar")
+ */
+static void Expr_select(const char* kernels /* in */) {
+#  ifdef EXPR_X86
+   if (strcmp(kernels, "avx512") == 0) Expr_run = Expr_run_avx512;
+   else if (strcmp(kernels, "avx2") == 0) Expr_run = Expr_run_avx2;
+   else Expr_run = Expr_run_default;
+#  else
+   Expr_run = Expr_run_default;
+#  endif
+}  /* Expr_select */
+
+#endif
@@ -0,0 +1,30 @@
+/* File:     vector_file.h
+ *
+ * Purpose:  Layout of the binary vector files read and written by
+ *           vector_add and mpi_vector_add.
+ *
+ * Notes:
+ * 1.  A file is a VEC_HEADER_SIZE byte header (see Vec_header)
+ *     followed by the n elements in native byte order.  Element i is
+ *     at byte offset VEC_HEADER_SIZE + i*elem_size.
+ * 2.  The data starts at VEC_HEADER_SIZE so that it is cache-line
+ *     (and AVX-512) aligned when the file is mapped, and so that
+ *     block offsets used by MPI-IO are multiples of the element size.
+ * 3.  A program only reads files of the element type it was compiled
+ *     for (see vector_type.h); there is no conversion.
+ */
+#ifndef VECTOR_FILE_H
+#define VECTOR_FILE_H
+
+#define VEC_MAGIC "VECADD1"
+#define VEC_HEADER_SIZE 64
+enum {VEC_FLOAT64 = 1, VEC_FLOAT32 = 2};
+
+typedef struct {
+   char       magic[8];   /* VEC_MAGIC, NUL terminated  */
+   long long  n;          /* number of elements         */
+   int        dtype;      /* VEC_FLOAT64 or VEC_FLOAT32 */
+   int        elem_size;  /* 8 or 4                     */
+} Vec_header;
+
+#endif
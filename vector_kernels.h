@@ -0,0 +1,514 @@
+/* File:     vector_kernels.h
+ *
+ * Purpose:  Vector sum, dot product and scalar multiply kernels with
+ *           scalar, SSE2, AVX2 and AVX-512 implementations.  The
+ *           implementation is chosen once at startup by
+ *           Select_kernels from the CPU's CPUID feature bits.  The
+ *           kernels are written once for the element type elem_t of
+ *           vector_type.h (double, float, or float with double
+ *           accumulation).
+ *
+ * Usage:    #include "vector_kernels.h", call Select_kernels() once,
+ *           then call the kernels through Kernels.sum, Kernels.dot,
+ *           Kernels.scale and Kernels.fused.
+ *
+ * Notes:
+ * 1.  Setting the environment variable VECTOR_KERNELS to scalar, sse2,
+ *     avx2 or avx512 forces that implementation (if the CPU supports
+ *     it), e.g. VECTOR_KERNELS=scalar for A/B comparisons.
+ * 2.  The SIMD loops first peel scalar iterations until the output
+ *     (or, for the dot product, x) is aligned to the vector width, so
+ *     the main loop uses aligned stores whatever the alignment of the
+ *     buffers; inputs are loaded unaligned.  The remaining elements
+ *     are handled by a scalar tail (a masked tail for AVX-512).
+ * 3.  The SIMD versions need GCC or Clang on x86; elsewhere only the
+ *     scalar kernels are built.
+ * 4.  Kernels.fused computes z = x + y, scaled_x = scalar*x,
+ *     scaled_y = scalar*y and returns x.y in a single pass, reading
+ *     2 and writing 3 streams.  scaled_x and scaled_y may be x and y
+ *     themselves.
+ * 5.  The SIMD code uses the VK128, VK256 and VK512 macros, which turn
+ *     an operation name into the _ps or _pd intrinsic for elem_t (and
+ *     VKA128, ... for acc_t).  When the elements are floats and the
+ *     accumulators doubles, the Madd_* helpers convert each half of
+ *     a float vector to double and accumulate the two halves
+ *     separately.
+ */
+#ifndef VECTOR_KERNELS_H
+#define VECTOR_KERNELS_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "vector_type.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define VK_X86 1
+#include <immintrin.h>
+#endif
+
+typedef struct {
+   const char* name;
+   void   (*sum)(const elem_t x[], const elem_t y[], elem_t z[],
+                 long long n);
+   acc_t  (*dot)(const elem_t x[], const elem_t y[], long long n);
+   void   (*scale)(const elem_t a[], elem_t scalar, elem_t result[],
+                   long long n);
+   acc_t  (*fused)(const elem_t x[], const elem_t y[], elem_t scalar,
+                   elem_t z[], elem_t scaled_x[], elem_t scaled_y[],
+                   long long n);
+} Kernel_table;
+
+/* The kernels chosen by Select_kernels */
+static Kernel_table Kernels;
+
+
+/*---------------------------------------------------------------------
+ * Function:  Peel_count
+ * Purpose:   Number of elements to process before p is aligned to
+ *            align bytes (at most n)
+ */
+static long long Peel_count(const elem_t* p, size_t align, long long n) {
+   long long peel = (long long)
+      (((align - (uintptr_t) p % align) % align) / sizeof(elem_t));
+
+   if ((uintptr_t) p % sizeof(elem_t) != 0) return n;
+   return peel < n ? peel : n;
+}  /* Peel_count */
+
+
+/*---------------------------------------------------------------------
+ * Scalar kernels
+ */
+static void Sum_scalar(const elem_t x[], const elem_t y[], elem_t z[],
+      long long n) {
+   long long i;
+   for (i = 0; i < n; i++)
+      z[i] = x[i] + y[i];
+}  /* Sum_scalar */
+
+static acc_t Dot_scalar(const elem_t x[], const elem_t y[],
+      long long n) {
+   long long i;
+   acc_t sum = 0.0;
+   for (i = 0; i < n; i++)
+      sum += (acc_t) x[i]*y[i];
+   return sum;
+}  /* Dot_scalar */
+
+static void Scale_scalar(const elem_t a[], elem_t scalar,
+      elem_t result[], long long n) {
+   long long i;
+   for (i = 0; i < n; i++)
+      result[i] = scalar*a[i];
+}  /* Scale_scalar */
+
+static acc_t Fused_scalar(const elem_t x[], const elem_t y[],
+      elem_t scalar, elem_t z[], elem_t scaled_x[], elem_t scaled_y[],
+      long long n) {
+   long long i;
+   acc_t sum = 0.0;
+   elem_t xi, yi;
+   for (i = 0; i < n; i++) {
+      xi = x[i];
+      yi = y[i];
+      z[i] = xi + yi;
+      sum += (acc_t) xi*yi;
+      scaled_x[i] = scalar*xi;
+      scaled_y[i] = scalar*yi;
+   }
+   return sum;
+}  /* Fused_scalar */
+
+
+#ifdef VK_X86
+/*---------------------------------------------------------------------
+ * Vector types and intrinsics for elem_t (VK*) and acc_t (VKA*)
+ */
+#define VK_CAT_(a, b) a ## b
+#define VK_CAT(a, b) VK_CAT_(a, b)
+#if ELEM_IS_FLOAT
+#define VK_E ps
+typedef __m128 vk128;
+typedef __m256 vk256;
+typedef __m512 vk512;
+typedef __mmask16 vk_mask512;
+#else
+#define VK_E pd
+typedef __m128d vk128;
+typedef __m256d vk256;
+typedef __m512d vk512;
+typedef __mmask8 vk_mask512;
+#endif
+#if ACC_IS_FLOAT
+#define VK_A ps
+typedef __m128 vka128;
+typedef __m256 vka256;
+typedef __m512 vka512;
+#else
+#define VK_A pd
+typedef __m128d vka128;
+typedef __m256d vka256;
+typedef __m512d vka512;
+#endif
+#define VK_WIDEN (ELEM_IS_FLOAT && !ACC_IS_FLOAT)
+
+#define VK128(op) VK_CAT(_mm_##op##_, VK_E)
+#define VK256(op) VK_CAT(_mm256_##op##_, VK_E)
+#define VK512(op) VK_CAT(_mm512_##op##_, VK_E)
+#define VKA128(op) VK_CAT(_mm_##op##_, VK_A)
+#define VKA256(op) VK_CAT(_mm256_##op##_, VK_A)
+#define VKA512(op) VK_CAT(_mm512_##op##_, VK_A)
+
+/* Elements per vector of a width in bytes */
+#define VK_LANES(bytes) ((long long) ((bytes)/sizeof(elem_t)))
+#define VKA_LANES(bytes) ((bytes)/(int) sizeof(acc_t))
+
+/*---------------------------------------------------------------------
+ * Function:  Hsum
+ * Purpose:   Add up the lanes of an accumulator, in pairs
+ * In/out arg:  part:  the lanes (a power of 2 of them), overwritten
+ */
+static acc_t Hsum(acc_t part[], int lanes) {
+   int i;
+
+   for (; lanes > 1; lanes /= 2)
+      for (i = 0; i < lanes/2; i++)
+         part[i] = part[2*i] + part[2*i+1];
+   return part[0];
+}  /* Hsum */
+
+
+/*---------------------------------------------------------------------
+ * Function:  Madd_sse2, Madd_avx2, Madd_avx512
+ * Purpose:   acc + x*y, with the products of float elements widened
+ *            to double when acc_t is double
+ */
+__attribute__((target("sse2")))
+static inline vka128 Madd_sse2(vka128 acc, vk128 x, vk128 y) {
+#  if VK_WIDEN
+   acc = _mm_add_pd(acc, _mm_mul_pd(_mm_cvtps_pd(x), _mm_cvtps_pd(y)));
+   return _mm_add_pd(acc, _mm_mul_pd(_mm_cvtps_pd(_mm_movehl_ps(x, x)),
+            _mm_cvtps_pd(_mm_movehl_ps(y, y))));
+#  else
+   return VK128(add)(acc, VK128(mul)(x, y));
+#  endif
+}  /* Madd_sse2 */
+
+__attribute__((target("avx2")))
+static inline vka256 Madd_avx2(vka256 acc, vk256 x, vk256 y) {
+#  if VK_WIDEN
+   acc = _mm256_add_pd(acc, _mm256_mul_pd(
+            _mm256_cvtps_pd(_mm256_castps256_ps128(x)),
+            _mm256_cvtps_pd(_mm256_castps256_ps128(y))));
+   return _mm256_add_pd(acc, _mm256_mul_pd(
+            _mm256_cvtps_pd(_mm256_extractf128_ps(x, 1)),
+            _mm256_cvtps_pd(_mm256_extractf128_ps(y, 1))));
+#  else
+   return VK256(add)(acc, VK256(mul)(x, y));
+#  endif
+}  /* Madd_avx2 */
+
+#if VK_WIDEN
+/* Upper 8 floats of a 16 float vector, with AVX-512F only */
+#define VK_HI256(v) \
+   _mm256_castpd_ps(_mm512_extractf64x4_pd(_mm512_castps_pd(v), 1))
+#endif
+
+__attribute__((target("avx512f")))
+static inline vka512 Madd_avx512(vka512 acc, vk512 x, vk512 y) {
+#  if VK_WIDEN
+   acc = _mm512_fmadd_pd(_mm512_cvtps_pd(_mm512_castps512_ps256(x)),
+         _mm512_cvtps_pd(_mm512_castps512_ps256(y)), acc);
+   return _mm512_fmadd_pd(_mm512_cvtps_pd(VK_HI256(x)),
+         _mm512_cvtps_pd(VK_HI256(y)), acc);
+#  else
+   return VK512(fmadd)(x, y, acc);
+#  endif
+}  /* Madd_avx512 */
+
+
+/*---------------------------------------------------------------------
+ * SSE2 kernels:  16 byte vectors (2 doubles or 4 floats)
+ */
+#define L128 VK_LANES(16)
+
+__attribute__((target("sse2")))
+static void Sum_sse2(const elem_t x[], const elem_t y[], elem_t z[],
+      long long n) {
+   long long i = Peel_count(z, 16, n);
+
+   Sum_scalar(x, y, z, i);
+   for (; i + L128 <= n; i += L128)
+      VK128(store)(z + i, VK128(add)(VK128(loadu)(x + i),
+               VK128(loadu)(y + i)));
+   Sum_scalar(x + i, y + i, z + i, n - i);
+}  /* Sum_sse2 */
+
+__attribute__((target("sse2")))
+static acc_t Dot_sse2(const elem_t x[], const elem_t y[], long long n) {
+   long long i = Peel_count(x, 16, n);
+   acc_t sum = Dot_scalar(x, y, i);
+   acc_t part[VKA_LANES(16)];
+   vka128 acc0 = VKA128(setzero)(), acc1 = VKA128(setzero)();
+
+   for (; i + 2*L128 <= n; i += 2*L128) {
+      acc0 = Madd_sse2(acc0, VK128(load)(x + i), VK128(loadu)(y + i));
+      acc1 = Madd_sse2(acc1, VK128(load)(x + i + L128),
+            VK128(loadu)(y + i + L128));
+   }
+   VKA128(storeu)(part, VKA128(add)(acc0, acc1));
+   return sum + Hsum(part, VKA_LANES(16)) + Dot_scalar(x + i, y + i, n - i);
+}  /* Dot_sse2 */
+
+__attribute__((target("sse2")))
+static void Scale_sse2(const elem_t a[], elem_t scalar, elem_t result[],
+      long long n) {
+   long long i = Peel_count(result, 16, n);
+   vk128 s = VK128(set1)(scalar);
+
+   Scale_scalar(a, scalar, result, i);
+   for (; i + L128 <= n; i += L128)
+      VK128(store)(result + i, VK128(mul)(s, VK128(loadu)(a + i)));
+   Scale_scalar(a + i, scalar, result + i, n - i);
+}  /* Scale_sse2 */
+
+__attribute__((target("sse2")))
+static acc_t Fused_sse2(const elem_t x[], const elem_t y[],
+      elem_t scalar, elem_t z[], elem_t scaled_x[], elem_t scaled_y[],
+      long long n) {
+   long long i = Peel_count(z, 16, n);
+   acc_t sum = Fused_scalar(x, y, scalar, z, scaled_x, scaled_y, i);
+   acc_t part[VKA_LANES(16)];
+   vk128 s = VK128(set1)(scalar), xv, yv;
+   vka128 acc = VKA128(setzero)();
+
+   for (; i + L128 <= n; i += L128) {
+      xv = VK128(loadu)(x + i);
+      yv = VK128(loadu)(y + i);
+      VK128(store)(z + i, VK128(add)(xv, yv));
+      acc = Madd_sse2(acc, xv, yv);
+      VK128(storeu)(scaled_x + i, VK128(mul)(s, xv));
+      VK128(storeu)(scaled_y + i, VK128(mul)(s, yv));
+   }
+   VKA128(storeu)(part, acc);
+   return sum + Hsum(part, VKA_LANES(16)) + Fused_scalar(x + i, y + i,
+         scalar, z + i, scaled_x + i, scaled_y + i, n - i);
+}  /* Fused_sse2 */
+
+
+/*---------------------------------------------------------------------
+ * AVX2 kernels:  32 byte vectors (4 doubles or 8 floats)
+ */
+#define L256 VK_LANES(32)
+
+__attribute__((target("avx2")))
+static void Sum_avx2(const elem_t x[], const elem_t y[], elem_t z[],
+      long long n) {
+   long long i = Peel_count(z, 32, n);
+
+   Sum_scalar(x, y, z, i);
+   for (; i + L256 <= n; i += L256)
+      VK256(store)(z + i, VK256(add)(VK256(loadu)(x + i),
+               VK256(loadu)(y + i)));
+   Sum_scalar(x + i, y + i, z + i, n - i);
+}  /* Sum_avx2 */
+
+__attribute__((target("avx2")))
+static acc_t Dot_avx2(const elem_t x[], const elem_t y[], long long n) {
+   long long i = Peel_count(x, 32, n);
+   acc_t sum = Dot_scalar(x, y, i);
+   acc_t part[VKA_LANES(32)];
+   vka256 acc0 = VKA256(setzero)(), acc1 = VKA256(setzero)();
+
+   for (; i + 2*L256 <= n; i += 2*L256) {
+      acc0 = Madd_avx2(acc0, VK256(load)(x + i), VK256(loadu)(y + i));
+      acc1 = Madd_avx2(acc1, VK256(load)(x + i + L256),
+            VK256(loadu)(y + i + L256));
+   }
+   VKA256(storeu)(part, VKA256(add)(acc0, acc1));
+   return sum + Hsum(part, VKA_LANES(32)) + Dot_scalar(x + i, y + i, n - i);
+}  /* Dot_avx2 */
+
+__attribute__((target("avx2")))
+static void Scale_avx2(const elem_t a[], elem_t scalar, elem_t result[],
+      long long n) {
+   long long i = Peel_count(result, 32, n);
+   vk256 s = VK256(set1)(scalar);
+
+   Scale_scalar(a, scalar, result, i);
+   for (; i + L256 <= n; i += L256)
+      VK256(store)(result + i, VK256(mul)(s, VK256(loadu)(a + i)));
+   Scale_scalar(a + i, scalar, result + i, n - i);
+}  /* Scale_avx2 */
+
+__attribute__((target("avx2")))
+static acc_t Fused_avx2(const elem_t x[], const elem_t y[],
+      elem_t scalar, elem_t z[], elem_t scaled_x[], elem_t scaled_y[],
+      long long n) {
+   long long i = Peel_count(z, 32, n);
+   acc_t sum = Fused_scalar(x, y, scalar, z, scaled_x, scaled_y, i);
+   acc_t part[VKA_LANES(32)];
+   vk256 s = VK256(set1)(scalar), xv, yv;
+   vka256 acc = VKA256(setzero)();
+
+   for (; i + L256 <= n; i += L256) {
+      xv = VK256(loadu)(x + i);
+      yv = VK256(loadu)(y + i);
+      VK256(store)(z + i, VK256(add)(xv, yv));
+      acc = Madd_avx2(acc, xv, yv);
+      VK256(storeu)(scaled_x + i, VK256(mul)(s, xv));
+      VK256(storeu)(scaled_y + i, VK256(mul)(s, yv));
+   }
+   VKA256(storeu)(part, acc);
+   return sum + Hsum(part, VKA_LANES(32))
+      + Fused_scalar(x + i, y + i, scalar, z + i, scaled_x + i,
+            scaled_y + i, n - i);
+}  /* Fused_avx2 */
+
+
+/*---------------------------------------------------------------------
+ * AVX-512 kernels:  64 byte vectors (8 doubles or 16 floats), masked
+ * tail
+ */
+#define L512 VK_LANES(64)
+
+__attribute__((target("avx512f")))
+static void Sum_avx512(const elem_t x[], const elem_t y[], elem_t z[],
+      long long n) {
+   long long i = Peel_count(z, 64, n);
+   vk_mask512 m;
+
+   Sum_scalar(x, y, z, i);
+   for (; i + L512 <= n; i += L512)
+      VK512(store)(z + i, VK512(add)(VK512(loadu)(x + i),
+               VK512(loadu)(y + i)));
+   if (i < n) {
+      m = (vk_mask512) ((1u << (n - i)) - 1);
+      VK512(mask_storeu)(z + i, m, VK512(add)(
+               VK512(maskz_loadu)(m, x + i),
+               VK512(maskz_loadu)(m, y + i)));
+   }
+}  /* Sum_avx512 */
+
+__attribute__((target("avx512f")))
+static acc_t Dot_avx512(const elem_t x[], const elem_t y[],
+      long long n) {
+   long long i = Peel_count(x, 64, n);
+   acc_t sum = Dot_scalar(x, y, i);
+   vka512 acc0 = VKA512(setzero)(), acc1 = VKA512(setzero)();
+   vk_mask512 m;
+
+   for (; i + 2*L512 <= n; i += 2*L512) {
+      acc0 = Madd_avx512(acc0, VK512(load)(x + i), VK512(loadu)(y + i));
+      acc1 = Madd_avx512(acc1, VK512(load)(x + i + L512),
+            VK512(loadu)(y + i + L512));
+   }
+   if (i + L512 <= n) {
+      acc0 = Madd_avx512(acc0, VK512(load)(x + i), VK512(loadu)(y + i));
+      i += L512;
+   }
+   if (i < n) {
+      m = (vk_mask512) ((1u << (n - i)) - 1);
+      acc1 = Madd_avx512(acc1, VK512(maskz_loadu)(m, x + i),
+            VK512(maskz_loadu)(m, y + i));
+   }
+   return sum + VKA512(reduce_add)(VKA512(add)(acc0, acc1));
+}  /* Dot_avx512 */
+
+__attribute__((target("avx512f")))
+static void Scale_avx512(const elem_t a[], elem_t scalar,
+      elem_t result[], long long n) {
+   long long i = Peel_count(result, 64, n);
+   vk512 s = VK512(set1)(scalar);
+   vk_mask512 m;
+
+   Scale_scalar(a, scalar, result, i);
+   for (; i + L512 <= n; i += L512)
+      VK512(store)(result + i, VK512(mul)(s, VK512(loadu)(a + i)));
+   if (i < n) {
+      m = (vk_mask512) ((1u << (n - i)) - 1);
+      VK512(mask_storeu)(result + i, m,
+            VK512(mul)(s, VK512(maskz_loadu)(m, a + i)));
+   }
+}  /* Scale_avx512 */
+
+__attribute__((target("avx512f")))
+static acc_t Fused_avx512(const elem_t x[], const elem_t y[],
+      elem_t scalar, elem_t z[], elem_t scaled_x[], elem_t scaled_y[],
+      long long n) {
+   long long i = Peel_count(z, 64, n);
+   acc_t sum = Fused_scalar(x, y, scalar, z, scaled_x, scaled_y, i);
+   vk512 s = VK512(set1)(scalar), xv, yv;
+   vka512 acc = VKA512(setzero)();
+   vk_mask512 m;
+
+   for (; i + L512 <= n; i += L512) {
+      xv = VK512(loadu)(x + i);
+      yv = VK512(loadu)(y + i);
+      VK512(store)(z + i, VK512(add)(xv, yv));
+      acc = Madd_avx512(acc, xv, yv);
+      VK512(storeu)(scaled_x + i, VK512(mul)(s, xv));
+      VK512(storeu)(scaled_y + i, VK512(mul)(s, yv));
+   }
+   if (i < n) {
+      m = (vk_mask512) ((1u << (n - i)) - 1);
+      xv = VK512(maskz_loadu)(m, x + i);
+      yv = VK512(maskz_loadu)(m, y + i);
+      VK512(mask_storeu)(z + i, m, VK512(add)(xv, yv));
+      acc = Madd_avx512(acc, xv, yv);
+      VK512(mask_storeu)(scaled_x + i, m, VK512(mul)(s, xv));
+      VK512(mask_storeu)(scaled_y + i, m, VK512(mul)(s, yv));
+   }
+   return sum + VKA512(reduce_add)(acc);
+}  /* Fused_avx512 */
+#endif  /* VK_X86 */
+
+
+/*---------------------------------------------------------------------
+ * Function:  Select_kernels
+ * Purpose:   Fill in Kernels with the widest implementation the CPU
+ *            supports, or with the one named by VECTOR_KERNELS
+ * Return:    the name of the implementation chosen
+ */
+static const char* Select_kernels(void) {
+   static const Kernel_table scalar =
+      {"scalar", Sum_scalar, Dot_scalar, Scale_scalar, Fused_scalar};
+   const char* wanted = getenv("VECTOR_KERNELS");
+#  ifdef VK_X86
+   static const Kernel_table sse2 =
+      {"sse2", Sum_sse2, Dot_sse2, Scale_sse2, Fused_sse2};
+   static const Kernel_table avx2 =
+      {"avx2", Sum_avx2, Dot_avx2, Scale_avx2, Fused_avx2};
+   static const Kernel_table avx512 =
+      {"avx512", Sum_avx512, Dot_avx512, Scale_avx512, Fused_avx512};
+   const Kernel_table* supported[4];
+   int count = 0, i;
+
+   __builtin_cpu_init();
+   if (__builtin_cpu_supports("avx512f")) supported[count++] = &avx512;
+   if (__builtin_cpu_supports("avx2")) supported[count++] = &avx2;
+   if (__builtin_cpu_supports("sse2")) supported[count++] = &sse2;
+   supported[count++] = &scalar;
+
+   Kernels = *supported[0];
+   if (wanted != NULL) {
+      for (i = 0; i < count; i++)
+         if (strcmp(wanted, supported[i]->name) == 0) break;
+      if (i < count)
+         Kernels = *supported[i];
+      else
+         fprintf(stderr, "VECTOR_KERNELS=%s is not available, using %s\n",
+               wanted, Kernels.name);
+   }
+#  else
+   Kernels = scalar;
+   if (wanted != NULL && strcmp(wanted, "scalar") != 0)
+      fprintf(stderr, "VECTOR_KERNELS=%s is not available, using %s\n",
+            wanted, Kernels.name);
+#  endif
+   return Kernels.name;
+}  /* Select_kernels */
+
+#endif  /* VECTOR_KERNELS_H */
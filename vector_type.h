@@ -0,0 +1,61 @@
+/* File:     vector_type.h
+ *
+ * Purpose:  Element type of the vectors, chosen when a program is
+ *           compiled:
+ *              (default)     double storage, double dot products
+ *              -DVEC_FLOAT   float storage, float dot products
+ *              -DVEC_MIXED   float storage, double dot products
+ *
+ * Usage:    #include "vector_type.h" and use elem_t for the vector
+ *           elements, acc_t for dot products and other sums of
+ *           elements, MPI_ELEM and MPI_ACC in MPI calls, ELEM_SCAN to
+ *           scanf an element and ELEM_FMT to printf one.
+ *
+ * Notes:
+ * 1.  float storage halves the memory and the bandwidth the kernels
+ *     need, and doubles the elements in each SIMD vector.
+ * 2.  With -DVEC_MIXED the product of two floats is exact in double,
+ *     so the dot product only rounds in the additions, as it would for
+ *     double vectors.
+ * 3.  Doubles are printed with "%f" as before.  Floats are printed
+ *     with "%g", i.e. with the FLT_DIG (6) significant digits a float
+ *     holds, rather than with digits that are only rounding noise.
+ */
+#ifndef VECTOR_TYPE_H
+#define VECTOR_TYPE_H
+
+#include "vector_file.h"
+
+#if defined(VEC_FLOAT) || defined(VEC_MIXED)
+typedef float elem_t;
+#define ELEM_IS_FLOAT 1
+#define MPI_ELEM MPI_FLOAT
+#define ELEM_SCAN "%f"
+#define ELEM_FMT "%g"
+#define ELEM_DTYPE VEC_FLOAT32
+#else
+typedef double elem_t;
+#define ELEM_IS_FLOAT 0
+#define MPI_ELEM MPI_DOUBLE
+#define ELEM_SCAN "%lf"
+#define ELEM_FMT "%f"
+#define ELEM_DTYPE VEC_FLOAT64
+#endif
+
+#if defined(VEC_FLOAT) && !defined(VEC_MIXED)
+typedef float acc_t;
+#define ACC_IS_FLOAT 1
+#define MPI_ACC MPI_FLOAT
+#define ELEM_NAME "float"
+#else
+typedef double acc_t;
+#define ACC_IS_FLOAT 0
+#define MPI_ACC MPI_DOUBLE
+#if ELEM_IS_FLOAT
+#define ELEM_NAME "float (double accumulation)"
+#else
+#define ELEM_NAME "double"
+#endif
+#endif
+
+#endif